@@ -8,24 +8,97 @@
 #include <iomanip>
 #include <string>
 #include <sstream>
+#include <cstring>
+#include <cctype>
+#include <new>
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RESTIR_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// Funções com AVX2 são compiladas à parte e só chamadas após checagem via CPUID
+#if defined(RESTIR_X86) && defined(__GNUC__)
+#define RESTIR_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RESTIR_TARGET_AVX2
+#endif
 
 using namespace std;
 
 const float PI = 3.14159265359f;
 const float EPSILON = 1e-6f;
-const int WIDTH = 800;
-const int HEIGHT = 600;
+const int TILE_SIZE = 32; // Lado dos blocos distribuídos entre as threads
 
 // Variáveis globais configuráveis
+int WIDTH = 800;  // Resolução (--width/--height); a cena acompanha, 1 unidade por pixel
+int HEIGHT = 600;
+int OUT_OF_CORE_ROWS = 0; // > 0: renderiza em faixas dessa altura direto para o arquivo
 int MAX_CANDIDATES = 30;
 bool ENABLE_SPATIAL_REUSE = true;
+int SPATIAL_PASSES = 1;    // Passes de reutilização espacial (ping-pong entre dois buffers)
+int SPATIAL_NEIGHBORS = 0; // Vizinhos por pixel e passe; 0 = padrão do modo (4 biased, 3 unbiased)
+int SPATIAL_RADIUS = 20;   // Raio (pixels) dos vizinhos; com os passes, define o halo das faixas
+int SPATIAL_NEIGHBOR_MODE = 0; // SpatialNeighborMode
+// Etapas do quadro em frente de onda sobre faixas de blocos (ver renderFusedTiles).
+// Opcional: cada passo da frente de onda tem só (passes + 1) faixas de blocos
+// para distribuir, e o ganho com muitas threads ainda não foi medido
+bool FUSED_PIPELINE = false;
 bool ENABLE_TEMPORAL_REUSE = true;
 bool USE_BASELINE_IMAGE = false;
 bool USE_UNBIASED_MODE = false;
 bool USE_MONTE_CARLO_ONLY = false;
 int BASELINE_RIS_SAMPLES = 0; // NOVA VARIÁVEL: 0 = desabilitado
 int RECURSIVE_ITERATIONS = 1; // NOVA VARIÁVEL: quantidade de renderizações sequenciais a partir do baseline
+bool SHADOW_RAYS = false;      // Raio de sombra para a amostra final de cada pixel (--shadows)
+bool VISIBILITY_REUSE = false; // Zera reservatórios ocluídos antes da reutilização espacial
+int SEQUENCE_FRAMES = 0; // > 0: sequência animada com reprojeção temporal (--frames)
+string SCENE_FILE;       // --scene: cena em texto ou binário (.rscn) no lugar da cena padrão
+string WRITE_SCENE_FILE; // --write-scene: grava a cena no formato binário e sai
+string SWEEP_FILE; // --sweep: arquivo de tarefas renderizadas no mesmo processo
+int NUM_THREADS = 0; // 0 = usa todos os núcleos disponíveis
+bool RUN_BVH_BENCHMARK = false;
+bool RUN_KERNEL_BENCHMARK = false;
+int SPHERE_KERNEL = -1; // -1 = automático (CPUID); senão um SphereKernelType
+int LIGHT_SAMPLING = 0; // Distribuição de origem dos candidatos (LightSamplingType)
+bool RUN_LIGHT_SAMPLING_BENCHMARK = false;
+bool RUN_LIGHT_TREE_BENCHMARK = false;
+bool USE_LIGHT_BATCH = true; // Avalia candidatos em lotes SoA/AVX2
+bool USE_PACKED_RESERVOIRS = false; // Quadros de reservatórios no formato compacto de 8 bytes
+bool RUN_RESERVOIR_LAYOUT_BENCHMARK = false;
+bool RUN_UNBIASED_REUSE_BENCHMARK = false;
+bool RUN_HOT_KERNEL_BENCHMARK = false;
+string BENCHMARK_JSON_FILE = "restir_benchmark.json"; // Saída JSON dos benchmarks ("-" = stdout)
+bool RUN_CONVERGENCE_BENCHMARK = false;
+bool RUN_FUSED_PIPELINE_BENCHMARK = false;
+string CONVERGENCE_CONFIGS = "mc:32,ris:8,ris:32,biased:8,unbiased:8,biased:32,unbiased:32";
+double TIME_BUDGET = 2.0; // Segundos por configuração no benchmark de convergência
+int SAMPLE_BUDGET = 0;    // > 0: candidatos por pixel por configuração (substitui TIME_BUDGET)
+int REFERENCE_SAMPLES = 32;  // Candidatos RIS por quadro da referência do benchmark de convergência
+int REFERENCE_FRAMES = 64;   // Quadros RIS independentes somados na referência
+int IMAGE_FORMAT = 1; // Formato de saída (ImageFormat); padrão: P6 binário
+int LIGHT_CACHE_BUDGET_MB = 256; // Cache por pixel das contribuições das luzes; 0 = desativado
+string METRICS_FILE; // --metrics: JSON com tempos por fase e contadores (builds com RESTIR_METRICS)
+string CHECKPOINT_FILE; // Checkpoint de reservatórios: lido na partida e regravado a cada render()
+unsigned int RANDOM_SEED = 0; // Semente base (--seed); padrão: time(NULL)
 
 // Classe para vetores 3D
 class Vec3 {
@@ -37,6 +110,9 @@ public:
     Vec3 operator-(const Vec3& other) const { return Vec3(x - other.x, y - other.y, z - other.z); }
     Vec3 operator*(float scalar) const { return Vec3(x * scalar, y * scalar, z * scalar); }
     float dot(const Vec3& other) const { return x * other.x + y * other.y + z * other.z; }
+    Vec3 cross(const Vec3& other) const {
+        return Vec3(y * other.z - z * other.y, z * other.x - x * other.z, x * other.y - y * other.x);
+    }
     float length() const { return sqrt(x * x + y * y + z * z); }
     Vec3 normalize() const {
         float len = length();
@@ -66,8 +142,258 @@ public:
 // Funções auxiliares C++98 compatíveis
 float fmax(float a, float b) { return (a > b) ? a : b; }
 float fmin(float a, float b) { return (a < b) ? a : b; }
-float randomFloat() { return static_cast<float>(rand()) / static_cast<float>(RAND_MAX); }
-int randomInt(int max) { return rand() % max; }
+
+// Relógio de parede em segundos (clock() mede tempo de CPU somado entre threads)
+double wallTime() {
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    return static_cast<double>(clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+// Instrumentação (--metrics): tempo de parede por fase, contadores do caminho
+// quente e histograma do M final. Só existe quando compilado com RESTIR_METRICS
+// (CMake: -DRESTIR_METRICS=ON); sem ela as macros METRIC_* não geram código.
+enum MetricPhase {
+    PHASE_SCENE_LOAD = 0,
+    PHASE_SCENE_BUILD,
+    PHASE_GBUFFER,
+    PHASE_BASELINE,
+    PHASE_INITIAL_RIS,
+    PHASE_TEMPORAL,
+    PHASE_VISIBILITY,
+    PHASE_SPATIAL,
+    PHASE_SHADING,
+    PHASE_IO,
+    PHASE_COUNT
+};
+
+enum MetricCounter {
+    COUNTER_CANDIDATES = 0,
+    COUNTER_TARGET_PDF,
+    COUNTER_COMBINE_ACCEPTED,
+    COUNTER_COMBINE_REJECTED,
+    COUNTER_NEIGHBOR_OUT_OF_BOUNDS,
+    COUNTER_TEMPORAL_REJECTED,
+    COUNTER_SHADOW_RAYS,
+    COUNTER_SHADOW_OCCLUDED,
+    COUNTER_COUNT
+};
+
+#ifdef RESTIR_METRICS
+class RenderMetrics {
+public:
+    static const int MAX_THREADS = 256;
+    static const int M_BUCKETS = 32; // 0: M == 0; b > 0: 2^(b-1) <= M < 2^b
+    
+    double phaseSeconds[PHASE_COUNT];
+    double backgroundIOSeconds; // Gravações da thread de E/S (sobrepostas à renderização)
+    int frames;
+    
+    RenderMetrics() : backgroundIOSeconds(0.0), frames(0) {
+        memset(phaseSeconds, 0, sizeof(phaseSeconds));
+        memset(slots, 0, sizeof(slots));
+    }
+    
+    // Contadores por thread (sem atômicos); somados só na leitura
+    void count(MetricCounter counter, unsigned long long n) { slots[threadSlot()].counters[counter] += n; }
+    
+    void recordM(int M) {
+        int bucket = 0;
+        while (M > 0 && bucket < M_BUCKETS - 1) {
+            M >>= 1;
+            bucket++;
+        }
+        slots[threadSlot()].mHistogram[bucket]++;
+    }
+    
+    void addPhase(MetricPhase phase, double seconds) {
+#pragma omp atomic
+        phaseSeconds[phase] += seconds;
+    }
+    
+    // Fases intercaladas no mesmo laço paralelo: cada thread acumula o tempo
+    // gasto em cada uma (addSplit) e commitSplits divide o tempo de parede do
+    // laço entre elas na proporção desses tempos
+    void addSplit(MetricPhase phase, double seconds) { slots[threadSlot()].splitSeconds[phase] += seconds; }
+    
+    void commitSplits(double wallSeconds) {
+        double split[PHASE_COUNT] = { 0.0 };
+        double total = 0.0;
+        for (int t = 0; t < MAX_THREADS; t++) {
+            for (int p = 0; p < PHASE_COUNT; p++) {
+                split[p] += slots[t].splitSeconds[p];
+                total += slots[t].splitSeconds[p];
+                slots[t].splitSeconds[p] = 0.0;
+            }
+        }
+        if (total <= 0.0) return;
+        for (int p = 0; p < PHASE_COUNT; p++) phaseSeconds[p] += wallSeconds * split[p] / total;
+    }
+    
+    unsigned long long total(MetricCounter counter) const {
+        unsigned long long sum = 0;
+        for (int t = 0; t < MAX_THREADS; t++) sum += slots[t].counters[counter];
+        return sum;
+    }
+    
+    bool writeJSON(const string& filename, double totalSeconds) const {
+        static const char* phaseNames[PHASE_COUNT] = {
+            "scene_load", "scene_build", "gbuffer", "baseline", "initial_ris", "temporal", "visibility", "spatial", "shading", "io"
+        };
+        static const char* counterNames[COUNTER_COUNT] = {
+            "candidates_evaluated", "target_pdf_evaluations", "combines_accepted",
+            "combines_rejected", "neighbors_out_of_bounds", "temporal_reprojections_rejected",
+            "shadow_rays", "shadow_rays_occluded"
+        };
+        unsigned long long histogram[M_BUCKETS] = { 0 };
+        int lastBucket = 0;
+        for (int b = 0; b < M_BUCKETS; b++) {
+            for (int t = 0; t < MAX_THREADS; t++) histogram[b] += slots[t].mHistogram[b];
+            if (histogram[b] > 0) lastBucket = b;
+        }
+        
+        ofstream file(filename.c_str());
+        file << fixed << setprecision(6);
+        file << "{" << endl;
+        file << "  \"frames\": " << frames << "," << endl;
+        file << "  \"total_seconds\": " << totalSeconds << "," << endl;
+        file << "  \"phases_seconds\": {";
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            file << (p > 0 ? ", " : "") << "\"" << phaseNames[p] << "\": " << phaseSeconds[p];
+        }
+        file << "}," << endl;
+        file << "  \"io_background_seconds\": " << backgroundIOSeconds << "," << endl;
+        file << "  \"counters\": {";
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            file << (c > 0 ? ", " : "") << "\"" << counterNames[c] << "\": " << total(static_cast<MetricCounter>(c));
+        }
+        file << "}," << endl;
+        file << "  \"final_m_histogram\": [" << endl;
+        for (int b = 0; b <= lastBucket; b++) {
+            long long low = (b == 0) ? 0 : (1LL << (b - 1));
+            long long high = (b == 0) ? 0 : (1LL << b) - 1;
+            file << "    {\"min\": " << low << ", \"max\": " << high << ", \"pixels\": " << histogram[b] << "}"
+                 << (b < lastBucket ? "," : "") << endl;
+        }
+        file << "  ]" << endl;
+        file << "}" << endl;
+        if (!file) {
+            cerr << "Erro: não foi possível gravar as métricas em " << filename << endl;
+            return false;
+        }
+        cout << "Métricas gravadas em " << filename << endl;
+        return true;
+    }
+    
+private:
+    // Uma linha por thread, separadas por uma linha de cache (sem falso compartilhamento)
+    struct ThreadSlot {
+        unsigned long long counters[COUNTER_COUNT];
+        unsigned long long mHistogram[M_BUCKETS];
+        double splitSeconds[PHASE_COUNT];
+        char padding[64];
+    };
+    
+    static int threadSlot() {
+#ifdef _OPENMP
+        return omp_get_thread_num() % MAX_THREADS;
+#else
+        return 0;
+#endif
+    }
+    
+    ThreadSlot slots[MAX_THREADS];
+};
+
+RenderMetrics metrics;
+
+// Soma o tempo de parede do escopo à fase
+class PhaseTimer {
+public:
+    explicit PhaseTimer(MetricPhase phase) : phase(phase), start(wallTime()) {}
+    ~PhaseTimer() { metrics.addPhase(phase, wallTime() - start); }
+private:
+    MetricPhase phase;
+    double start;
+};
+
+#define METRIC_COUNT(counter, n) metrics.count(counter, n)
+#define METRIC_RECORD_M(M) metrics.recordM(M)
+#define METRIC_PHASE(phase) PhaseTimer metricPhaseTimer(phase)
+#define METRIC_CLOCK(name) double name = wallTime()
+#define METRIC_SPLIT(phase, since) metrics.addSplit(phase, wallTime() - since)
+#define METRIC_COMMIT_SPLITS(since) metrics.commitSplits(wallTime() - since)
+#define METRIC_END_PHASE(phase, since) metrics.addPhase(phase, wallTime() - since)
+#define METRIC_BACKGROUND_IO(seconds) metrics.backgroundIOSeconds += (seconds)
+#define METRIC_FRAME() metrics.frames++
+#else
+// Macros de instrução viram ((void)0), não vazio: "if (c) METRIC_COUNT(...);" não
+// fica com corpo vazio. METRIC_PHASE/METRIC_CLOCK declaram variáveis e somem.
+#define METRIC_COUNT(counter, n) ((void)0)
+#define METRIC_RECORD_M(M) ((void)0)
+#define METRIC_PHASE(phase)
+#define METRIC_CLOCK(name)
+#define METRIC_SPLIT(phase, since) ((void)0)
+#define METRIC_COMMIT_SPLITS(since) ((void)0)
+#define METRIC_END_PHASE(phase, since) ((void)0)
+#define METRIC_BACKGROUND_IO(seconds) ((void)0)
+#define METRIC_FRAME() ((void)0)
+#endif
+
+// Contador de alocações no heap, ligado só pelos benchmarks. O operator new
+// global só é substituído em builds com RESTIR_COUNT_ALLOCATIONS (o restir_bench
+// do CMake): o renderizador e quem linka restir_core mantêm o alocador padrão.
+bool COUNT_ALLOCATIONS = false;
+unsigned long allocationCount = 0;
+
+#ifdef RESTIR_COUNT_ALLOCATIONS
+void* operator new(size_t size) throw(std::bad_alloc) {
+    if (COUNT_ALLOCATIONS) {
+#pragma omp atomic
+        allocationCount++;
+    }
+    void* p = malloc(size > 0 ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+// Fora de linha: inlinada, o GCC veria free() sobre um ponteiro de operator new
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void operator delete(void* p) throw() {
+    free(p);
+}
+#endif
+
+// Gerador aleatório baseado em contador (hash PCG). Cada fluxo é identificado por
+// (semente, quadro, passo, pixel) e cada chamada consome um índice de amostra, então
+// o valor obtido não depende da ordem de avaliação nem da thread que processa o pixel.
+unsigned int pcgHash(unsigned int v) {
+    unsigned int state = v * 747796405u + 2891336453u;
+    unsigned int word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+class RandomStream {
+public:
+    unsigned int key;
+    unsigned int counter;
+    
+    RandomStream() : key(0), counter(0) {}
+    RandomStream(unsigned int seed, unsigned int frame, unsigned int pass, unsigned int pixel)
+        : key(pcgHash(seed ^ pcgHash(frame ^ pcgHash(pass ^ pcgHash(pixel))))), counter(0) {}
+    
+    unsigned int nextUInt() { return pcgHash(key ^ pcgHash(counter++)); }
+    float nextFloat() { return static_cast<float>(nextUInt() >> 8) * (1.0f / 16777216.0f); }
+    // Redução por multiplicação (evita o viés do operador %)
+    int nextInt(int max) {
+        int i = static_cast<int>(static_cast<double>(nextUInt()) * (1.0 / 4294967296.0) * max);
+        return (i < max) ? i : max - 1;
+    }
+};
 
 // Classe para esferas
 class Sphere {
@@ -103,6 +429,474 @@ public:
     }
 };
 
+// Esferas em estrutura de arranjos (SoA), na ordem das folhas da BVH.
+// Os arranjos têm SIMD_PADDING entradas extras para que os kernels possam
+// ler 8 posições a partir de qualquer índice válido.
+class SphereSoA {
+public:
+    vector<float> centerX, centerY, centerZ, radius2;
+    static const int SIMD_PADDING = 8;
+    
+    void build(const vector<Sphere>& spheres, const vector<int>& order) {
+        size_t n = order.size() + SIMD_PADDING;
+        centerX.assign(n, 0.0f);
+        centerY.assign(n, 0.0f);
+        centerZ.assign(n, 0.0f);
+        radius2.assign(n, -1e30f); // Entradas de preenchimento nunca são atingidas
+        for (size_t i = 0; i < order.size(); i++) {
+            const Sphere& sphere = spheres[order[i]];
+            centerX[i] = sphere.center.x;
+            centerY[i] = sphere.center.y;
+            centerZ[i] = sphere.center.z;
+            radius2[i] = sphere.radius * sphere.radius;
+        }
+    }
+};
+
+// Kernels de interseção de um raio (direção normalizada) contra as esferas
+// [first, first + count) do SoA. Retornam o índice da mais próxima com
+// EPSILON < t < tHit (atualizando tHit) ou -1. Todas as variantes fazem as
+// mesmas operações na mesma ordem, então produzem exatamente o mesmo t.
+enum SphereKernelType {
+    SPHERE_KERNEL_SCALAR = 0,
+    SPHERE_KERNEL_SSE = 1,
+    SPHERE_KERNEL_AVX2 = 2
+};
+
+typedef int (*SphereLeafKernel)(const SphereSoA& soa, int first, int count,
+                                const Vec3& rayOrigin, const Vec3& rayDir, float& tHit);
+
+int intersectSpheresScalar(const SphereSoA& soa, int first, int count,
+                           const Vec3& rayOrigin, const Vec3& rayDir, float& tHit) {
+    int closest = -1;
+    for (int i = first; i < first + count; i++) {
+        float ocx = rayOrigin.x - soa.centerX[i];
+        float ocy = rayOrigin.y - soa.centerY[i];
+        float ocz = rayOrigin.z - soa.centerZ[i];
+        // a = 1 (direção normalizada): t = -b' +- sqrt(b'^2 - c), com b' = oc . d
+        float b = ocx * rayDir.x + ocy * rayDir.y + ocz * rayDir.z;
+        float c = ocx * ocx + ocy * ocy + ocz * ocz - soa.radius2[i];
+        float discriminant = b * b - c;
+        if (discriminant < 0) continue;
+        float sqrtDiscriminant = sqrt(discriminant);
+        float t = -b - sqrtDiscriminant;
+        if (!(t > EPSILON)) t = -b + sqrtDiscriminant;
+        if (t > EPSILON && t < tHit) {
+            tHit = t;
+            closest = i;
+        }
+    }
+    return closest;
+}
+
+#ifdef RESTIR_X86
+int intersectSpheresSSE(const SphereSoA& soa, int first, int count,
+                        const Vec3& rayOrigin, const Vec3& rayDir, float& tHit) {
+    const __m128 ox = _mm_set1_ps(rayOrigin.x), oy = _mm_set1_ps(rayOrigin.y), oz = _mm_set1_ps(rayOrigin.z);
+    const __m128 dx = _mm_set1_ps(rayDir.x), dy = _mm_set1_ps(rayDir.y), dz = _mm_set1_ps(rayDir.z);
+    const __m128 eps = _mm_set1_ps(EPSILON), noHit = _mm_set1_ps(1e30f), zero = _mm_setzero_ps();
+    int closest = -1;
+    for (int i = first; i < first + count; i += 4) {
+        __m128 ocx = _mm_sub_ps(ox, _mm_loadu_ps(&soa.centerX[i]));
+        __m128 ocy = _mm_sub_ps(oy, _mm_loadu_ps(&soa.centerY[i]));
+        __m128 ocz = _mm_sub_ps(oz, _mm_loadu_ps(&soa.centerZ[i]));
+        __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+        __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)),
+                              _mm_loadu_ps(&soa.radius2[i]));
+        __m128 discriminant = _mm_sub_ps(_mm_mul_ps(b, b), c);
+        __m128 valid = _mm_cmpge_ps(discriminant, zero);
+        __m128 sqrtDiscriminant = _mm_sqrt_ps(_mm_max_ps(discriminant, zero));
+        __m128 negB = _mm_sub_ps(zero, b);
+        __m128 t1 = _mm_sub_ps(negB, sqrtDiscriminant);
+        __m128 t2 = _mm_add_ps(negB, sqrtDiscriminant);
+        __m128 use1 = _mm_cmpgt_ps(t1, eps);
+        __m128 t = _mm_or_ps(_mm_and_ps(use1, t1), _mm_andnot_ps(use1, t2));
+        valid = _mm_and_ps(valid, _mm_cmpgt_ps(t, eps));
+        t = _mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, noHit));
+        
+        // Redução mascarada: só desce ao escalar se alguma faixa melhora tHit
+        int lanes = min(4, first + count - i);
+        int mask = _mm_movemask_ps(_mm_cmplt_ps(t, _mm_set1_ps(tHit))) & ((1 << lanes) - 1);
+        if (mask) {
+            float tLanes[4];
+            _mm_storeu_ps(tLanes, t);
+            for (int lane = 0; lane < lanes; lane++) {
+                if ((mask & (1 << lane)) && tLanes[lane] < tHit) {
+                    tHit = tLanes[lane];
+                    closest = i + lane;
+                }
+            }
+        }
+    }
+    return closest;
+}
+
+RESTIR_TARGET_AVX2
+int intersectSpheresAVX2(const SphereSoA& soa, int first, int count,
+                         const Vec3& rayOrigin, const Vec3& rayDir, float& tHit) {
+    const __m256 ox = _mm256_set1_ps(rayOrigin.x), oy = _mm256_set1_ps(rayOrigin.y), oz = _mm256_set1_ps(rayOrigin.z);
+    const __m256 dx = _mm256_set1_ps(rayDir.x), dy = _mm256_set1_ps(rayDir.y), dz = _mm256_set1_ps(rayDir.z);
+    const __m256 eps = _mm256_set1_ps(EPSILON), noHit = _mm256_set1_ps(1e30f), zero = _mm256_setzero_ps();
+    int closest = -1;
+    for (int i = first; i < first + count; i += 8) {
+        __m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(&soa.centerX[i]));
+        __m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(&soa.centerY[i]));
+        __m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(&soa.centerZ[i]));
+        __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz));
+        __m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)),
+                                               _mm256_mul_ps(ocz, ocz)),
+                                 _mm256_loadu_ps(&soa.radius2[i]));
+        __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(b, b), c);
+        __m256 valid = _mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ);
+        __m256 sqrtDiscriminant = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+        __m256 negB = _mm256_sub_ps(zero, b);
+        __m256 t1 = _mm256_sub_ps(negB, sqrtDiscriminant);
+        __m256 t2 = _mm256_add_ps(negB, sqrtDiscriminant);
+        __m256 t = _mm256_blendv_ps(t2, t1, _mm256_cmp_ps(t1, eps, _CMP_GT_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, eps, _CMP_GT_OQ));
+        t = _mm256_blendv_ps(noHit, t, valid);
+        
+        int lanes = min(8, first + count - i);
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(t, _mm256_set1_ps(tHit), _CMP_LT_OQ)) & ((1 << lanes) - 1);
+        if (mask) {
+            float tLanes[8];
+            _mm256_storeu_ps(tLanes, t);
+            for (int lane = 0; lane < lanes; lane++) {
+                if ((mask & (1 << lane)) && tLanes[lane] < tHit) {
+                    tHit = tLanes[lane];
+                    closest = i + lane;
+                }
+            }
+        }
+    }
+    return closest;
+}
+#endif
+
+bool cpuSupportsAVX2() {
+#if defined(RESTIR_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#elif defined(RESTIR_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool osSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return osSavesYmm && (info[1] & (1 << 5));
+#else
+    return false;
+#endif
+}
+
+SphereKernelType detectSphereKernel() {
+#ifdef RESTIR_X86
+    return cpuSupportsAVX2() ? SPHERE_KERNEL_AVX2 : SPHERE_KERNEL_SSE;
+#else
+    return SPHERE_KERNEL_SCALAR;
+#endif
+}
+
+SphereLeafKernel getSphereKernel(SphereKernelType type) {
+#ifdef RESTIR_X86
+    if (type == SPHERE_KERNEL_AVX2 && cpuSupportsAVX2()) return intersectSpheresAVX2;
+    if (type != SPHERE_KERNEL_SCALAR) return intersectSpheresSSE;
+#endif
+    return intersectSpheresScalar;
+}
+
+const char* sphereKernelName(SphereKernelType type) {
+    switch (type) {
+        case SPHERE_KERNEL_AVX2: return "AVX2";
+        case SPHERE_KERNEL_SSE: return "SSE";
+        default: return "escalar";
+    }
+}
+
+// Caixa alinhada aos eixos usada pela BVH
+class AABB {
+public:
+    Vec3 bmin, bmax;
+    AABB() : bmin(1e30f, 1e30f, 1e30f), bmax(-1e30f, -1e30f, -1e30f) {}
+    
+    void grow(const Vec3& p) {
+        bmin = Vec3(fmin(bmin.x, p.x), fmin(bmin.y, p.y), fmin(bmin.z, p.z));
+        bmax = Vec3(fmax(bmax.x, p.x), fmax(bmax.y, p.y), fmax(bmax.z, p.z));
+    }
+    void grow(const AABB& b) {
+        if (b.bmin.x > b.bmax.x) return;
+        grow(b.bmin);
+        grow(b.bmax);
+    }
+    float area() const {
+        if (bmin.x > bmax.x) return 0.0f;
+        Vec3 e = bmax - bmin;
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+    // Teste de slabs; retorna a distância de entrada ou 1e30f se não houver interseção
+    float intersect(const Vec3& rayOrigin, const Vec3& invDir, float tMax) const {
+        float tx1 = (bmin.x - rayOrigin.x) * invDir.x, tx2 = (bmax.x - rayOrigin.x) * invDir.x;
+        float tmin = fmin(tx1, tx2), tmax = fmax(tx1, tx2);
+        float ty1 = (bmin.y - rayOrigin.y) * invDir.y, ty2 = (bmax.y - rayOrigin.y) * invDir.y;
+        tmin = fmax(tmin, fmin(ty1, ty2)); tmax = fmin(tmax, fmax(ty1, ty2));
+        float tz1 = (bmin.z - rayOrigin.z) * invDir.z, tz2 = (bmax.z - rayOrigin.z) * invDir.z;
+        tmin = fmax(tmin, fmin(tz1, tz2)); tmax = fmin(tmax, fmax(tz1, tz2));
+        if (tmax >= tmin && tmin < tMax && tmax > 0.0f) return tmin;
+        return 1e30f;
+    }
+};
+
+// Nó da BVH em arranjo plano: se count > 0 é folha com as esferas
+// [first, first + count) de sphereIndices; senão os filhos são first e first + 1
+struct BVHNode {
+    AABB bounds;
+    int first;
+    int count;
+};
+
+// BVH sobre esferas construída com SAH por bins e percorrida sem recursão.
+// As folhas são testadas com um kernel SoA escolhido em tempo de execução.
+class SphereBVH {
+public:
+    vector<BVHNode> nodes;
+    vector<int> sphereIndices;
+    SphereSoA soa;
+    SphereLeafKernel leafKernel;
+    
+    SphereBVH() : leafKernel(intersectSpheresScalar) {}
+    
+    static const int SAH_BINS = 12;
+    static const int MAX_LEAF_SIZE = 8; // Uma folha cheia = um teste AVX2
+    static const int MAX_SAH_DEPTH = 48; // Abaixo disso só divisões pela mediana (limita a pilha)
+    static const int STACK_SIZE = 96;
+    
+    void build(const vector<Sphere>& spheres) {
+        nodes.clear();
+        sphereIndices.resize(spheres.size());
+        leafKernel = getSphereKernel(SPHERE_KERNEL >= 0 ? static_cast<SphereKernelType>(SPHERE_KERNEL) : detectSphereKernel());
+        if (spheres.empty()) {
+            soa.build(spheres, sphereIndices);
+            return;
+        }
+        
+        vector<AABB> sphereBounds(spheres.size());
+        vector<Vec3> centroids(spheres.size());
+        for (size_t i = 0; i < spheres.size(); i++) {
+            // Margem pequena: raios tangentes sobre a face da caixa não podem ser descartados
+            float padded = spheres[i].radius * 1.0001f + 1e-4f;
+            Vec3 r(padded, padded, padded);
+            sphereBounds[i].grow(spheres[i].center - r);
+            sphereBounds[i].grow(spheres[i].center + r);
+            centroids[i] = spheres[i].center;
+            sphereIndices[i] = static_cast<int>(i);
+        }
+        
+        nodes.reserve(2 * spheres.size());
+        BVHNode root;
+        root.first = 0;
+        root.count = static_cast<int>(spheres.size());
+        nodes.push_back(root);
+        
+        // Construção iterativa: subdivide os nós na ordem em que são criados
+        vector<int> pending(1, 0);
+        vector<int> pendingDepth(1, 0);
+        while (!pending.empty()) {
+            int nodeIndex = pending.back();
+            int depth = pendingDepth.back();
+            pending.pop_back();
+            pendingDepth.pop_back();
+            BVHNode& node = nodes[nodeIndex];
+            
+            AABB centroidBounds;
+            node.bounds = AABB();
+            for (int i = node.first; i < node.first + node.count; i++) {
+                node.bounds.grow(sphereBounds[sphereIndices[i]]);
+                centroidBounds.grow(centroids[sphereIndices[i]]);
+            }
+            if (node.count <= MAX_LEAF_SIZE) continue;
+            
+            int axis;
+            float splitPos;
+            float splitCost = findBestSplit(node, centroidBounds, sphereBounds, centroids, axis, splitPos);
+            float leafCost = static_cast<float>(node.count) * node.bounds.area();
+            
+            int mid;
+            if (depth >= MAX_SAH_DEPTH) {
+                mid = node.first;
+            } else if (splitCost < leafCost) {
+                int i = node.first;
+                int j = node.first + node.count - 1;
+                while (i <= j) {
+                    if (axisValue(centroids[sphereIndices[i]], axis) < splitPos) i++;
+                    else swap(sphereIndices[i], sphereIndices[j--]);
+                }
+                mid = i;
+            } else {
+                mid = node.first;
+            }
+            
+            // Partição degenerada (centróides coincidentes ou SAH sem ganho): divide pela mediana
+            if (mid == node.first || mid == node.first + node.count) {
+                if (node.count <= 2 * MAX_LEAF_SIZE && depth < MAX_SAH_DEPTH && splitCost >= leafCost) continue;
+                Vec3 extent = centroidBounds.bmax - centroidBounds.bmin;
+                axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+                mid = node.first + node.count / 2;
+                CentroidLess less(centroids, axis);
+                nth_element(sphereIndices.begin() + node.first, sphereIndices.begin() + mid,
+                            sphereIndices.begin() + node.first + node.count, less);
+            }
+            
+            int leftCount = mid - node.first;
+            int firstChild = static_cast<int>(nodes.size());
+            BVHNode left, right;
+            left.first = node.first;
+            left.count = leftCount;
+            right.first = mid;
+            right.count = node.count - leftCount;
+            node.first = firstChild;
+            node.count = 0;
+            // Atenção: push_back pode invalidar a referência "node"
+            nodes.push_back(left);
+            nodes.push_back(right);
+            pending.push_back(firstChild);
+            pending.push_back(firstChild + 1);
+            pendingDepth.push_back(depth + 1);
+            pendingDepth.push_back(depth + 1);
+        }
+        
+        soa.build(spheres, sphereIndices);
+    }
+    
+    // Retorna o índice da esfera mais próxima (ou -1) e a distância em tHit.
+    // rayDir deve estar normalizada (exigência dos kernels SoA).
+    int intersect(const Vec3& rayOrigin, const Vec3& rayDir, float& tHit) const {
+        int closestSphere = -1;
+        tHit = 1e30f;
+        if (nodes.empty()) return -1;
+        
+        Vec3 invDir = inverseDirection(rayDir);
+        int stack[STACK_SIZE];
+        int stackSize = 0;
+        int nodeIndex = 0;
+        if (nodes[0].bounds.intersect(rayOrigin, invDir, tHit) >= 1e30f) return -1;
+        
+        while (true) {
+            const BVHNode& node = nodes[nodeIndex];
+            if (node.count > 0) {
+                int slot = leafKernel(soa, node.first, node.count, rayOrigin, rayDir, tHit);
+                if (slot >= 0) closestSphere = sphereIndices[slot];
+                if (stackSize == 0) break;
+                nodeIndex = stack[--stackSize];
+                continue;
+            }
+            
+            // Visita primeiro o filho mais próximo e empilha o outro
+            int child1 = node.first;
+            int child2 = node.first + 1;
+            float d1 = nodes[child1].bounds.intersect(rayOrigin, invDir, tHit);
+            float d2 = nodes[child2].bounds.intersect(rayOrigin, invDir, tHit);
+            if (d1 > d2) { swap(d1, d2); swap(child1, child2); }
+            if (d1 >= 1e30f) {
+                if (stackSize == 0) break;
+                nodeIndex = stack[--stackSize];
+            } else {
+                nodeIndex = child1;
+                if (d2 < 1e30f) stack[stackSize++] = child2;
+            }
+        }
+        
+        if (closestSphere < 0) tHit = 1e30f;
+        return closestSphere;
+    }
+    
+    // Consulta de oclusão (raios de sombra): há alguma esfera com
+    // EPSILON < t < maxDistance? Sai no primeiro acerto, sem ordenar os filhos
+    // nem procurar o mais próximo. rayDir normalizada, como em intersect().
+    bool occluded(const Vec3& rayOrigin, const Vec3& rayDir, float maxDistance) const {
+        if (nodes.empty()) return false;
+        Vec3 invDir = inverseDirection(rayDir);
+        int stack[STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0) {
+            const BVHNode& node = nodes[stack[--stackSize]];
+            if (node.bounds.intersect(rayOrigin, invDir, maxDistance) >= 1e30f) continue;
+            if (node.count > 0) {
+                float tHit = maxDistance;
+                if (leafKernel(soa, node.first, node.count, rayOrigin, rayDir, tHit) >= 0) return true;
+                continue;
+            }
+            stack[stackSize++] = node.first;
+            stack[stackSize++] = node.first + 1;
+        }
+        return false;
+    }
+    
+private:
+    static Vec3 inverseDirection(const Vec3& rayDir) {
+        return Vec3(fabs(rayDir.x) > EPSILON ? 1.0f / rayDir.x : (rayDir.x < 0 ? -1e30f : 1e30f),
+                    fabs(rayDir.y) > EPSILON ? 1.0f / rayDir.y : (rayDir.y < 0 ? -1e30f : 1e30f),
+                    fabs(rayDir.z) > EPSILON ? 1.0f / rayDir.z : (rayDir.z < 0 ? -1e30f : 1e30f));
+    }
+    
+    struct CentroidLess {
+        const vector<Vec3>& centroids;
+        int axis;
+        CentroidLess(const vector<Vec3>& c, int a) : centroids(c), axis(a) {}
+        bool operator()(int a, int b) const { return axisValue(centroids[a], axis) < axisValue(centroids[b], axis); }
+    };
+    
+    static float axisValue(const Vec3& v, int axis) {
+        return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+    }
+    
+    float findBestSplit(const BVHNode& node, const AABB& centroidBounds, const vector<AABB>& sphereBounds,
+                        const vector<Vec3>& centroids, int& bestAxis, float& bestPos) const {
+        float bestCost = 1e30f;
+        bestAxis = 0;
+        bestPos = 0.0f;
+        for (int axis = 0; axis < 3; axis++) {
+            float lo = axisValue(centroidBounds.bmin, axis);
+            float hi = axisValue(centroidBounds.bmax, axis);
+            if (hi - lo < EPSILON) continue;
+            
+            AABB binBounds[SAH_BINS];
+            int binCount[SAH_BINS] = { 0 };
+            float scale = SAH_BINS / (hi - lo);
+            for (int i = node.first; i < node.first + node.count; i++) {
+                int s = sphereIndices[i];
+                int bin = min(SAH_BINS - 1, static_cast<int>((axisValue(centroids[s], axis) - lo) * scale));
+                binCount[bin]++;
+                binBounds[bin].grow(sphereBounds[s]);
+            }
+            
+            // Varredura das áreas acumuladas à esquerda e à direita de cada plano
+            float leftArea[SAH_BINS - 1], rightArea[SAH_BINS - 1];
+            int leftCount[SAH_BINS - 1], rightCount[SAH_BINS - 1];
+            AABB leftBox, rightBox;
+            int leftSum = 0, rightSum = 0;
+            for (int i = 0; i < SAH_BINS - 1; i++) {
+                leftSum += binCount[i];
+                leftCount[i] = leftSum;
+                leftBox.grow(binBounds[i]);
+                leftArea[i] = leftBox.area();
+                rightSum += binCount[SAH_BINS - 1 - i];
+                rightCount[SAH_BINS - 2 - i] = rightSum;
+                rightBox.grow(binBounds[SAH_BINS - 1 - i]);
+                rightArea[SAH_BINS - 2 - i] = rightBox.area();
+            }
+            for (int i = 0; i < SAH_BINS - 1; i++) {
+                float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+                if (leftCount[i] > 0 && rightCount[i] > 0 && cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestPos = lo + (i + 1) / scale;
+                }
+            }
+        }
+        return bestCost;
+    }
+};
+
 // Classe para luzes
 class Light {
 public:
@@ -142,200 +936,1304 @@ public:
     Vec3 position;
     Vec3 normal;
     Color albedo;
-    bool isSphere;
+    int sphereIndex; // -1 = plano; usado na rejeição de reprojeções (oclusão)
     
-    SurfacePoint() : isSphere(false) {}
-    SurfacePoint(const Vec3& pos, const Vec3& norm, const Color& alb, bool sphere)
-        : position(pos), normal(norm), albedo(alb), isSphere(sphere) {}
+    SurfacePoint() : sphereIndex(-1) {}
+    SurfacePoint(const Vec3& pos, const Vec3& norm, const Color& alb, int sphere)
+        : position(pos), normal(norm), albedo(alb), sphereIndex(sphere) {}
 };
 
-// Classe específica para Monte Carlo (sem RIS)
-class MonteCarloReservoir {
+// targetPdf (calculateWeight) e contribuição RGB (calculateLighting) de uma luz em um pixel
+struct LightCacheEntry {
+    float targetPdf;
+    float r, g, b;
+};
+
+// Avaliação das luzes no ponto de sombreamento de um pixel. Com "cached" (linha
+// do LightContributionCache para o pixel) é uma consulta à tabela; sem, chama Light.
+class PixelLighting {
 public:
-    Color accumulatedColor;
-    float weight;
-    int M;
+    const vector<Light>& lights;
+    const SurfacePoint& point;
+    const LightCacheEntry* cached;
     
-    MonteCarloReservoir() : accumulatedColor(0, 0, 0), weight(0.0f), M(0) {}
+    PixelLighting(const vector<Light>& lights, const SurfacePoint& point, const LightCacheEntry* cached = 0)
+        : lights(lights), point(point), cached(cached) {}
     
-    void update(const vector<Light>& lights, const SurfacePoint& point, 
-                int candidateLightIndex) {
-        if (candidateLightIndex < 0 || candidateLightIndex >= static_cast<int>(lights.size())) {
-            return;
-        }
-        
-        float newTargetPdf = lights[candidateLightIndex].calculateWeight(
-            point.position, point.normal, point.albedo);
-        float sourcePdf = 1.0f / static_cast<float>(lights.size());
-        
-        float sampleWeight = (sourcePdf > EPSILON) ? newTargetPdf / sourcePdf : 0.0f;
-        
-        M++;
-        weight += sampleWeight;
-        
-        Color sampleColor = lights[candidateLightIndex].calculateLighting(
-            point.position, point.normal, point.albedo);
-        accumulatedColor += sampleColor * sampleWeight;
+    int lightCount() const { return static_cast<int>(lights.size()); }
+    
+    float targetPdf(int light) const {
+        METRIC_COUNT(COUNTER_TARGET_PDF, 1);
+        if (cached) return cached[light].targetPdf;
+        return lights[light].calculateWeight(point.position, point.normal, point.albedo);
     }
     
-    Color getFinalColor() const {
-        if (weight < EPSILON || M == 0) return Color(0, 0, 0);
-        return accumulatedColor * (1.0f / weight);
+    Color contribution(int light) const {
+        if (cached) return Color(cached[light].r, cached[light].g, cached[light].b);
+        return lights[light].calculateLighting(point.position, point.normal, point.albedo);
     }
 };
 
-// Classe Reservoir CORRIGIDA com MIS correto
-class Reservoir {
+// Distribuição de origem usada para sortear as luzes candidatas do RIS.
+// sample() devolve o índice sorteado e a pdf exata com que foi escolhido
+// para o ponto de sombreamento dado, que entra no peso RIS (targetPdf / sourcePdf).
+enum LightSamplingType {
+    LIGHT_SAMPLING_UNIFORM = 0,
+    LIGHT_SAMPLING_ALIAS = 1,
+    LIGHT_SAMPLING_TREE = 2
+};
+
+class LightSampler {
 public:
-    int lightIndex;
-    float targetPdf;
-    float weight;
-    int M;
-    int pixelOrigin;
-    
-    Reservoir() : lightIndex(-1), targetPdf(0.0f), weight(0.0f), M(0), pixelOrigin(-1) {}
+    virtual ~LightSampler() {}
+    virtual void build(const vector<Light>& lights) = 0;
+    virtual int sample(const SurfacePoint& point, RandomStream& rng, float& pdf) const = 0;
+    virtual float pdf(const SurfacePoint& point, int lightIndex) const = 0;
+    virtual const char* name() const = 0;
+};
 
-    void update(const vector<Light>& lights, const SurfacePoint& point, int candidateLightIndex) {
-        if (candidateLightIndex < 0 || candidateLightIndex >= static_cast<int>(lights.size())) return;
-        float newTargetPdf = lights[candidateLightIndex].calculateWeight(point.position, point.normal, point.albedo);
-        float sourcePdf = 1.0f / static_cast<float>(lights.size());
-        float sampleWeight = (sourcePdf > EPSILON) ? newTargetPdf / sourcePdf : 0.0f;
-        weight += sampleWeight;
-        M++;
-        if (weight > EPSILON && randomFloat() < sampleWeight / weight) {
-            lightIndex = candidateLightIndex;
-            targetPdf = newTargetPdf;
-        }
+class UniformLightSampler : public LightSampler {
+public:
+    int lightCount;
+    
+    UniformLightSampler() : lightCount(0) {}
+    void build(const vector<Light>& lights) { lightCount = static_cast<int>(lights.size()); }
+    int sample(const SurfacePoint&, RandomStream& rng, float& pdf) const {
+        pdf = 1.0f / static_cast<float>(lightCount);
+        return rng.nextInt(lightCount);
     }
+    float pdf(const SurfacePoint&, int) const { return 1.0f / static_cast<float>(lightCount); }
+    const char* name() const { return "uniforme"; }
+};
 
-    void combine(const Reservoir& other, const vector<Light>& lights, const SurfacePoint& point) {
-        if (other.lightIndex < 0 || other.M == 0) return;
-        
-        float otherWeight;
-        float otherTargetPdf;
+// Tabela de alias de Walker (construção de Vose): sorteio O(1) proporcional a
+// intensity * luminância(color)
+class AliasLightSampler : public LightSampler {
+public:
+    vector<float> probability; // Chance de manter a própria coluna
+    vector<int> alias;
+    vector<float> pdfs;
+    
+    void build(const vector<Light>& lights) {
+        int n = static_cast<int>(lights.size());
+        probability.assign(n, 1.0f);
+        alias.assign(n, 0);
+        pdfs.assign(n, n > 0 ? 1.0f / static_cast<float>(n) : 0.0f);
         
-        if (USE_UNBIASED_MODE) {
-            otherTargetPdf = lights[other.lightIndex].calculateWeight(point.position, point.normal, point.albedo);
-            otherWeight = otherTargetPdf * static_cast<float>(other.M);
-        } else {
-            otherTargetPdf = other.targetPdf;
-            otherWeight = other.targetPdf * static_cast<float>(other.M);
+        double total = 0.0;
+        for (int i = 0; i < n; i++) total += lightPower(lights[i]);
+        if (total <= 0.0) {
+            // Sem energia: recai na distribuição uniforme
+            for (int i = 0; i < n; i++) alias[i] = i;
+            return;
         }
         
-        weight += otherWeight;
-        M += other.M;
-        
-        if (weight > EPSILON && randomFloat() < otherWeight / weight) {
-            lightIndex = other.lightIndex;
-            targetPdf = otherTargetPdf;
+        vector<double> scaled(n);
+        vector<int> small, large;
+        for (int i = 0; i < n; i++) {
+            pdfs[i] = static_cast<float>(lightPower(lights[i]) / total);
+            scaled[i] = lightPower(lights[i]) / total * n;
+            if (scaled[i] < 1.0) small.push_back(i);
+            else large.push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            int s = small.back(); small.pop_back();
+            int l = large.back(); large.pop_back();
+            probability[s] = static_cast<float>(scaled[s]);
+            alias[s] = l;
+            scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+            if (scaled[l] < 1.0) small.push_back(l);
+            else large.push_back(l);
         }
+        // Sobras (erro de arredondamento) ficam com probabilidade 1
+        for (size_t i = 0; i < large.size(); i++) { probability[large[i]] = 1.0f; alias[large[i]] = large[i]; }
+        for (size_t i = 0; i < small.size(); i++) { probability[small[i]] = 1.0f; alias[small[i]] = small[i]; }
     }
-
-    Color getFinalColor(const vector<Light>& lights, const SurfacePoint& point) const {
-        if (lightIndex < 0 || targetPdf < EPSILON || M == 0) return Color(0, 0, 0);
-        float W = (weight / static_cast<float>(M)) / targetPdf;
-        return lights[lightIndex].calculateLighting(point.position, point.normal, point.albedo) * W;
+    
+    int sample(const SurfacePoint&, RandomStream& rng, float& pdf) const {
+        int column = rng.nextInt(static_cast<int>(probability.size()));
+        int lightIndex = (rng.nextFloat() < probability[column]) ? column : alias[column];
+        pdf = pdfs[lightIndex];
+        return lightIndex;
+    }
+    float pdf(const SurfacePoint&, int lightIndex) const { return pdfs[lightIndex]; }
+    const char* name() const { return "alias"; }
+    
+    static double lightPower(const Light& light) {
+        return fmax(0.0f, light.intensity * light.color.luminance());
     }
 };
 
-// IMPLEMENTAÇÃO CORRIGIDA: Combinação MIS conforme Algoritmo 6 do artigo
-Reservoir combineReservoirsUnbiasedMISCorrected(
-    int currentPixel,
-    const vector<Reservoir>& inputReservoirs,
-    const vector<int>& pixelOrigins,
-    const vector<SurfacePoint>& surfacePoints,
-    const vector<Light>& lights
-) {
-    Reservoir s;
-    s.pixelOrigin = currentPixel;
-    float totalM = 0;
+// Árvore de luzes (BVH sobre posições, uma luz por folha). A amostragem desce da
+// raiz escolhendo cada filho com probabilidade proporcional a uma estimativa de
+// importância para o ponto de sombreamento; a pdf é o produto dessas escolhas.
+struct LightTreeNode {
+    AABB bounds;
+    Vec3 center;     // Centro e raio da esfera envolvente de "bounds"
+    float radius;
+    float power;     // Soma de intensity * luminância das luzes da subárvore
+    int firstChild;  // Filhos em firstChild e firstChild + 1 (nós internos)
+    int lightIndex;  // >= 0 nas folhas
+    int parent;
+};
+
+class LightTreeSampler : public LightSampler {
+public:
+    vector<LightTreeNode> nodes;
+    vector<int> lightLeaf; // Folha de cada luz, para o cálculo de pdf()
     
-    // Para cada reservatório de entrada
-    for (size_t i = 0; i < inputReservoirs.size(); ++i) {
-        const Reservoir& r = inputReservoirs[i];
-        if (r.lightIndex < 0 || r.M == 0) continue;
-        
-        // Peso de reamostragem: targetPdf no pixel atual * W * M
-        float currentTargetPdf = lights[r.lightIndex].calculateWeight(
-            surfacePoints[currentPixel].position,
-            surfacePoints[currentPixel].normal,
-            surfacePoints[currentPixel].albedo
-        );
+    void build(const vector<Light>& lights) {
+        int n = static_cast<int>(lights.size());
+        nodes.clear();
+        lightLeaf.assign(n, -1);
+        if (n == 0) return;
         
-        // CORREÇÃO CRÍTICA: Usar o peso original do reservatório, não recalcular
-        float resamplingWeight = currentTargetPdf * static_cast<float>(r.M);
+        vector<int> order(n);
+        for (int i = 0; i < n; i++) order[i] = i;
+        vector<Vec3> positions(n);
+        for (int i = 0; i < n; i++) positions[i] = lights[i].position;
         
-        // Atualização do reservatório usando weighted reservoir sampling
-        s.weight += resamplingWeight;
-        totalM += static_cast<float>(r.M);
+        // Topologia: divisões pela mediana no maior eixo dos centróides
+        nodes.reserve(2 * n);
+        vector<int> rangeFirst, rangeCount;
+        nodes.push_back(makeNode(-1));
+        rangeFirst.push_back(0);
+        rangeCount.push_back(n);
+        for (size_t nodeIndex = 0; nodeIndex < nodes.size(); nodeIndex++) {
+            int first = rangeFirst[nodeIndex];
+            int count = rangeCount[nodeIndex];
+            if (count == 1) {
+                nodes[nodeIndex].lightIndex = order[first];
+                lightLeaf[order[first]] = static_cast<int>(nodeIndex);
+                continue;
+            }
+            AABB centroidBounds;
+            for (int i = first; i < first + count; i++) centroidBounds.grow(positions[order[i]]);
+            Vec3 extent = centroidBounds.bmax - centroidBounds.bmin;
+            int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+            int mid = first + count / 2;
+            PositionLess less(positions, axis);
+            nth_element(order.begin() + first, order.begin() + mid, order.begin() + first + count, less);
+            
+            nodes[nodeIndex].firstChild = static_cast<int>(nodes.size());
+            nodes.push_back(makeNode(static_cast<int>(nodeIndex)));
+            nodes.push_back(makeNode(static_cast<int>(nodeIndex)));
+            rangeFirst.push_back(first);
+            rangeCount.push_back(mid - first);
+            rangeFirst.push_back(mid);
+            rangeCount.push_back(first + count - mid);
+        }
         
-        if (s.weight > EPSILON && randomFloat() < resamplingWeight / s.weight) {
-            s.lightIndex = r.lightIndex;
-            s.targetPdf = currentTargetPdf;
+        // Filhos sempre vêm depois dos pais: agrega caixas e potências de trás para frente
+        for (int i = static_cast<int>(nodes.size()) - 1; i >= 0; i--) {
+            LightTreeNode& node = nodes[i];
+            if (node.lightIndex >= 0) {
+                node.bounds.grow(lights[node.lightIndex].position);
+                node.power = static_cast<float>(AliasLightSampler::lightPower(lights[node.lightIndex]));
+            } else {
+                node.bounds.grow(nodes[node.firstChild].bounds);
+                node.bounds.grow(nodes[node.firstChild + 1].bounds);
+                node.power = nodes[node.firstChild].power + nodes[node.firstChild + 1].power;
+            }
+            node.center = (node.bounds.bmin + node.bounds.bmax) * 0.5f;
+            node.radius = (node.bounds.bmax - node.center).length();
         }
     }
     
-    s.M = static_cast<int>(totalM);
+    int sample(const SurfacePoint& point, RandomStream& rng, float& pdf) const {
+        pdf = 0.0f;
+        if (nodes.empty()) return -1;
+        int nodeIndex = 0;
+        float probability = 1.0f;
+        while (nodes[nodeIndex].lightIndex < 0) {
+            int left = nodes[nodeIndex].firstChild;
+            float leftProbability = childProbability(point, left);
+            if (rng.nextFloat() < leftProbability) {
+                nodeIndex = left;
+                probability *= leftProbability;
+            } else {
+                nodeIndex = left + 1;
+                probability *= 1.0f - leftProbability;
+            }
+        }
+        pdf = probability;
+        return nodes[nodeIndex].lightIndex;
+    }
     
-    // CORREÇÃO CRÍTICA: Peso final conforme RIS padrão, sem MIS adicional
-    if (s.lightIndex >= 0 && s.targetPdf > EPSILON && s.M > 0) {
-        // Peso RIS padrão: (1/targetPdf) * (wsum/M)
-        float W = (s.weight / static_cast<float>(s.M)) / s.targetPdf;
-        s.weight = W * s.targetPdf * static_cast<float>(s.M); // Reconstrói weight para consistência
-    } else {
-        s.weight = 0.0f;
+    float pdf(const SurfacePoint& point, int lightIndex) const {
+        int nodeIndex = lightLeaf[lightIndex];
+        float probability = 1.0f;
+        while (nodes[nodeIndex].parent >= 0) {
+            int left = nodes[nodes[nodeIndex].parent].firstChild;
+            float leftProbability = childProbability(point, left);
+            probability *= (nodeIndex == left) ? leftProbability : 1.0f - leftProbability;
+            nodeIndex = nodes[nodeIndex].parent;
+        }
+        return probability;
     }
     
-    return s;
+    const char* name() const { return "arvore"; }
+    
+private:
+    struct PositionLess {
+        const vector<Vec3>& positions;
+        int axis;
+        PositionLess(const vector<Vec3>& p, int a) : positions(p), axis(a) {}
+        bool operator()(int a, int b) const {
+            const Vec3& pa = positions[a];
+            const Vec3& pb = positions[b];
+            return axis == 0 ? pa.x < pb.x : (axis == 1 ? pa.y < pb.y : pa.z < pb.z);
+        }
+    };
+    
+    static LightTreeNode makeNode(int parent) {
+        LightTreeNode node;
+        node.radius = 0.0f;
+        node.power = 0.0f;
+        node.firstChild = -1;
+        node.lightIndex = -1;
+        node.parent = parent;
+        return node;
+    }
+    
+    // Probabilidade de descer para o filho esquerdo (o direito recebe o complemento)
+    float childProbability(const SurfacePoint& point, int left) const {
+        float wl = importance(point, nodes[left]);
+        float wr = importance(point, nodes[left + 1]);
+        if (wl + wr <= 0.0f) {
+            // Nenhum filho pode iluminar o ponto: escolhe pela potência (pdf nunca zera)
+            wl = nodes[left].power;
+            wr = nodes[left + 1].power;
+            if (wl + wr <= 0.0f) return 0.5f;
+        }
+        return wl / (wl + wr);
+    }
+    
+    // Estimativa conservadora da contribuição da subárvore: potência, limite
+    // superior do cosseno (esfera envolvente da caixa) e a mesma atenuação de
+    // Light::calculateWeight avaliada na distância ao centro.
+    static float importance(const SurfacePoint& point, const LightTreeNode& node) {
+        float radius = node.radius;
+        Vec3 toCenter = node.center - point.position;
+        float distance2 = toCenter.dot(toCenter);
+        float distance = sqrt(distance2);
+        
+        float cosBound = 1.0f;
+        if (distance > radius) {
+            float cosTheta = point.normal.dot(toCenter) / distance;
+            float sinBound = radius / distance;
+            float cosBoundAngle = sqrt(fmax(0.0f, 1.0f - sinBound * sinBound));
+            if (cosTheta < cosBoundAngle) {
+                // cos(theta - thetaBound), limitado a zero
+                float sinTheta = sqrt(fmax(0.0f, 1.0f - cosTheta * cosTheta));
+                cosBound = fmax(0.0f, cosTheta * cosBoundAngle + sinTheta * sinBound);
+            }
+        }
+        
+        float d2 = fmax(fmax(distance2, radius * radius), 1.0f);
+        return node.power * cosBound / (d2 * (1.0f + d2 * 0.008f));
+    }
+};
+
+// Luzes em estrutura de arranjos, para avaliação em lote dos candidatos
+class LightSoA {
+public:
+    vector<float> positionX, positionY, positionZ;
+    vector<float> colorR, colorG, colorB;
+    vector<float> intensity;
+    
+    void build(const vector<Light>& lights) {
+        size_t n = lights.size();
+        positionX.resize(n); positionY.resize(n); positionZ.resize(n);
+        colorR.resize(n); colorG.resize(n); colorB.resize(n);
+        intensity.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            positionX[i] = lights[i].position.x;
+            positionY[i] = lights[i].position.y;
+            positionZ[i] = lights[i].position.z;
+            colorR[i] = lights[i].color.r;
+            colorG[i] = lights[i].color.g;
+            colorB[i] = lights[i].color.b;
+            intensity[i] = lights[i].intensity;
+        }
+    }
+};
+
+// Lote de até LIGHT_BATCH_SIZE candidatos: índices e pdfs de origem são
+// preenchidos pelo sorteio; targetPdf e a iluminação RGB pelo kernel.
+const int LIGHT_BATCH_SIZE = 8;
+
+struct CandidateBatch {
+    int count;
+    int lightIndex[LIGHT_BATCH_SIZE];
+    float sourcePdf[LIGHT_BATCH_SIZE];
+    float targetPdf[LIGHT_BATCH_SIZE];
+    float lightingR[LIGHT_BATCH_SIZE];
+    float lightingG[LIGHT_BATCH_SIZE];
+    float lightingB[LIGHT_BATCH_SIZE];
+};
+
+typedef void (*LightBatchKernel)(const vector<Light>& lights, const LightSoA& soa,
+                                 const SurfacePoint& point, CandidateBatch& batch);
+
+// Referência escalar: as mesmas funções de Light usadas fora do lote
+void evaluateLightBatchScalar(const vector<Light>& lights, const LightSoA&,
+                              const SurfacePoint& point, CandidateBatch& batch) {
+    for (int i = 0; i < batch.count; i++) {
+        int lightIndex = batch.lightIndex[i];
+        if (lightIndex < 0) continue;
+        batch.targetPdf[i] = lights[lightIndex].calculateWeight(point.position, point.normal, point.albedo);
+        Color lighting = lights[lightIndex].calculateLighting(point.position, point.normal, point.albedo);
+        batch.lightingR[i] = lighting.r;
+        batch.lightingG[i] = lighting.g;
+        batch.lightingB[i] = lighting.b;
+    }
+}
+
+#ifdef RESTIR_X86
+// 8 candidatos por instrução. Reproduz operação a operação calculateWeight e
+// calculateLighting (mesma ordem, sem FMA), então o resultado é idêntico ao escalar.
+RESTIR_TARGET_AVX2
+void evaluateLightBatchAVX2(const vector<Light>&, const LightSoA& soa,
+                            const SurfacePoint& point, CandidateBatch& batch) {
+    int gatherIndex[LIGHT_BATCH_SIZE];
+    for (int i = 0; i < LIGHT_BATCH_SIZE; i++) {
+        gatherIndex[i] = (i < batch.count && batch.lightIndex[i] >= 0) ? batch.lightIndex[i] : 0;
+    }
+    __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(gatherIndex));
+    
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 vx = _mm256_sub_ps(_mm256_i32gather_ps(&soa.positionX[0], index, 4), _mm256_set1_ps(point.position.x));
+    __m256 vy = _mm256_sub_ps(_mm256_i32gather_ps(&soa.positionY[0], index, 4), _mm256_set1_ps(point.position.y));
+    __m256 vz = _mm256_sub_ps(_mm256_i32gather_ps(&soa.positionZ[0], index, 4), _mm256_set1_ps(point.position.z));
+    __m256 distance = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)),
+                                                   _mm256_mul_ps(vz, vz)));
+    __m256 valid = _mm256_cmp_ps(distance, _mm256_set1_ps(EPSILON), _CMP_GE_OQ);
+    __m256 invDistance = _mm256_div_ps(_mm256_set1_ps(1.0f), distance);
+    __m256 cosTheta = _mm256_add_ps(_mm256_add_ps(
+        _mm256_mul_ps(_mm256_set1_ps(point.normal.x), _mm256_mul_ps(vx, invDistance)),
+        _mm256_mul_ps(_mm256_set1_ps(point.normal.y), _mm256_mul_ps(vy, invDistance))),
+        _mm256_mul_ps(_mm256_set1_ps(point.normal.z), _mm256_mul_ps(vz, invDistance)));
+    cosTheta = _mm256_max_ps(zero, cosTheta);
+    __m256 distance2 = _mm256_mul_ps(distance, distance);
+    __m256 geometricTerm = _mm256_div_ps(cosTheta, distance2);
+    __m256 attenuation = _mm256_div_ps(_mm256_i32gather_ps(&soa.intensity[0], index, 4),
+                                       _mm256_add_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(distance2, _mm256_set1_ps(0.008f))));
+    __m256 weightScale = _mm256_mul_ps(attenuation, geometricTerm);
+    __m256 lightingScale = _mm256_mul_ps(attenuation, cosTheta);
+    
+    __m256 cr = _mm256_i32gather_ps(&soa.colorR[0], index, 4);
+    __m256 cg = _mm256_i32gather_ps(&soa.colorG[0], index, 4);
+    __m256 cb = _mm256_i32gather_ps(&soa.colorB[0], index, 4);
+    __m256 ar = _mm256_set1_ps(point.albedo.r), ag = _mm256_set1_ps(point.albedo.g), ab = _mm256_set1_ps(point.albedo.b);
+    __m256 luminance = _mm256_add_ps(_mm256_add_ps(
+        _mm256_mul_ps(_mm256_set1_ps(0.299f), _mm256_mul_ps(_mm256_mul_ps(cr, ar), weightScale)),
+        _mm256_mul_ps(_mm256_set1_ps(0.587f), _mm256_mul_ps(_mm256_mul_ps(cg, ag), weightScale))),
+        _mm256_mul_ps(_mm256_set1_ps(0.114f), _mm256_mul_ps(_mm256_mul_ps(cb, ab), weightScale)));
+    
+    _mm256_storeu_ps(batch.targetPdf, _mm256_and_ps(valid, luminance));
+    _mm256_storeu_ps(batch.lightingR, _mm256_and_ps(valid, _mm256_mul_ps(_mm256_mul_ps(cr, lightingScale), ar)));
+    _mm256_storeu_ps(batch.lightingG, _mm256_and_ps(valid, _mm256_mul_ps(_mm256_mul_ps(cg, lightingScale), ag)));
+    _mm256_storeu_ps(batch.lightingB, _mm256_and_ps(valid, _mm256_mul_ps(_mm256_mul_ps(cb, lightingScale), ab)));
+}
+#endif
+
+LightBatchKernel getLightBatchKernel() {
+#ifdef RESTIR_X86
+    if (cpuSupportsAVX2()) return evaluateLightBatchAVX2;
+#endif
+    return evaluateLightBatchScalar;
+}
+
+// Classe específica para Monte Carlo (sem RIS)
+class MonteCarloReservoir {
+public:
+    Color accumulatedColor;
+    float weight;
+    int M;
+    
+    MonteCarloReservoir() : accumulatedColor(0, 0, 0), weight(0.0f), M(0) {}
+    
+    void update(const PixelLighting& lighting, int candidateLightIndex, float sourcePdf) {
+        if (candidateLightIndex < 0 || candidateLightIndex >= lighting.lightCount()) {
+            return;
+        }
+        
+        float newTargetPdf = lighting.targetPdf(candidateLightIndex);
+        Color sampleColor = lighting.contribution(candidateLightIndex);
+        updateEvaluated(newTargetPdf, sourcePdf, sampleColor);
+    }
+    
+    // Candidato já avaliado (caminho em lote)
+    void updateEvaluated(float newTargetPdf, float sourcePdf, const Color& sampleColor) {
+        float sampleWeight = (sourcePdf > EPSILON) ? newTargetPdf / sourcePdf : 0.0f;
+        
+        M++;
+        weight += sampleWeight;
+        accumulatedColor += sampleColor * sampleWeight;
+    }
+    
+    Color getFinalColor() const {
+        if (weight < EPSILON || M == 0) return Color(0, 0, 0);
+        return accumulatedColor * (1.0f / weight);
+    }
+};
+
+// Classe Reservoir CORRIGIDA com MIS correto
+class Reservoir {
+public:
+    int lightIndex;
+    float targetPdf;
+    float weight;
+    int M;
+    int pixelOrigin;
+    
+    Reservoir() : lightIndex(-1), targetPdf(0.0f), weight(0.0f), M(0), pixelOrigin(-1) {}
+
+    void update(const PixelLighting& lighting, int candidateLightIndex, float sourcePdf, RandomStream& rng) {
+        if (candidateLightIndex < 0 || candidateLightIndex >= lighting.lightCount()) return;
+        float newTargetPdf = lighting.targetPdf(candidateLightIndex);
+        updateEvaluated(candidateLightIndex, newTargetPdf, sourcePdf, rng);
+    }
+    
+    // Candidato já avaliado (caminho em lote)
+    void updateEvaluated(int candidateLightIndex, float newTargetPdf, float sourcePdf, RandomStream& rng) {
+        float sampleWeight = (sourcePdf > EPSILON) ? newTargetPdf / sourcePdf : 0.0f;
+        weight += sampleWeight;
+        M++;
+        if (weight > EPSILON && rng.nextFloat() < sampleWeight / weight) {
+            lightIndex = candidateLightIndex;
+            targetPdf = newTargetPdf;
+        }
+    }
+
+    // Em modo unbiased o alvo de "other" é reavaliado no pixel atual
+    void combine(const Reservoir& other, const PixelLighting& lighting, RandomStream& rng, bool unbiased) {
+        if (other.lightIndex < 0 || other.M == 0) return;
+        
+        float otherWeight;
+        float otherTargetPdf;
+        
+        if (unbiased) {
+            // A amostra é reavaliada aqui, então a oclusão precisa ser respeitada explicitamente
+            otherTargetPdf = lighting.targetPdf(other.lightIndex);
+            otherWeight = other.occluded() ? 0.0f : otherTargetPdf * static_cast<float>(other.M);
+        } else {
+            otherTargetPdf = other.targetPdf;
+            otherWeight = other.targetPdf * static_cast<float>(other.M);
+        }
+        
+        weight += otherWeight;
+        M += other.M;
+        
+        bool accepted = weight > EPSILON && rng.nextFloat() < otherWeight / weight;
+        if (accepted) {
+            lightIndex = other.lightIndex;
+            targetPdf = otherTargetPdf;
+        }
+        METRIC_COUNT(accepted ? COUNTER_COMBINE_ACCEPTED : COUNTER_COMBINE_REJECTED, 1);
+    }
+
+    // Reutilização de visibilidade: amostra ocluída fica com peso zero, mas M
+    // continua contando na normalização dos reservatórios que a combinarem.
+    // Os caminhos unbiased reavaliam o alvo no pixel de destino e, por isso,
+    // testam occluded() em vez de confiar no peso zerado.
+    void markOccluded() {
+        weight = 0.0f;
+        targetPdf = 0.0f;
+    }
+    
+    // Amostra presente, mas com alvo e peso zerados: só markOccluded() produz isso,
+    // pois uma amostra de peso zero nunca é escolhida por update()/combine()
+    bool occluded() const {
+        return lightIndex >= 0 && M > 0 && targetPdf == 0.0f && weight == 0.0f;
+    }
+    
+    bool contributes() const {
+        return lightIndex >= 0 && targetPdf >= EPSILON && M > 0;
+    }
+    
+    Color getFinalColor(const PixelLighting& lighting) const {
+        if (!contributes()) return Color(0, 0, 0);
+        float W = (weight / static_cast<float>(M)) / targetPdf;
+        return lighting.contribution(lightIndex) * W;
+    }
+};
+
+// Reservatório compacto (8 bytes, contra 20 do Reservoir) para os quadros completos.
+// targetPdf e weight usam um float de 16 bits sem sinal (6 bits de expoente com
+// bias 40, 10 de mantissa: ~1.8e-12 a ~1.7e7, erro relativo <= 2^-11); M é
+// saturado em 65535 e pixelOrigin não é armazenado (é sempre o próprio pixel).
+// A conversão acontece só na leitura/escrita: a matemática do combine segue em float.
+struct PackedReservoir {
+    unsigned short lightIndex; // 0xFFFF = vazio
+    unsigned short M;
+    unsigned short targetPdf;
+    unsigned short weight;
+    
+    static const int EXPONENT_BIAS = 40;
+    static const unsigned int MAX_LIGHTS = 0xFFFF;
+    
+    static unsigned short encodeFloat(float value) {
+        if (!(value > 0.0f)) return 0;
+        unsigned int bits;
+        memcpy(&bits, &value, sizeof(bits));
+        int exponent = static_cast<int>(bits >> 23) - 127 + EXPONENT_BIAS;
+        if (exponent < 1) return 0;
+        // Arredondamento para o mais próximo; o "vai um" da mantissa sobe para o expoente
+        unsigned int code = (static_cast<unsigned int>(exponent) << 10) + (((bits & 0x7FFFFF) + (1u << 12)) >> 13);
+        return static_cast<unsigned short>(code > 0xFFFF ? 0xFFFF : code);
+    }
+    
+    static float decodeFloat(unsigned short code) {
+        if (code == 0) return 0.0f;
+        unsigned int bits = ((static_cast<unsigned int>(code >> 10) - EXPONENT_BIAS + 127) << 23) |
+                            (static_cast<unsigned int>(code & 0x3FF) << 13);
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    
+    static PackedReservoir pack(const Reservoir& r) {
+        PackedReservoir p;
+        p.lightIndex = static_cast<unsigned short>(r.lightIndex < 0 ? 0xFFFF : r.lightIndex);
+        p.M = static_cast<unsigned short>(min(max(r.M, 0), 0xFFFF));
+        p.targetPdf = encodeFloat(r.targetPdf);
+        p.weight = encodeFloat(r.weight);
+        return p;
+    }
+    
+    Reservoir unpack(int pixelIndex) const {
+        Reservoir r;
+        r.lightIndex = (lightIndex == 0xFFFF) ? -1 : lightIndex;
+        r.M = M;
+        r.targetPdf = decodeFloat(targetPdf);
+        r.weight = decodeFloat(weight);
+        r.pixelOrigin = pixelIndex;
+        return r;
+    }
+};
+
+// Quadro completo de reservatórios em formato float (Reservoir) ou compacto
+// (PackedReservoir). Todo acesso passa por get/set, que convertem nas bordas.
+class ReservoirBuffer {
+public:
+    bool packed;
+    vector<Reservoir> full;
+    vector<PackedReservoir> compact;
+    
+    ReservoirBuffer() : packed(false) {}
+    
+    void resize(size_t n, bool usePacked) {
+        packed = usePacked;
+        if (packed) {
+            full.clear();
+            compact.assign(n, PackedReservoir::pack(Reservoir()));
+        } else {
+            compact.clear();
+            full.assign(n, Reservoir());
+        }
+    }
+    
+    // Como resize(), mas mantém o buffer (sem realocar nem limpar) quando o tamanho
+    // e o formato já são os pedidos: buffers por quadro são reaproveitados assim
+    void ensure(size_t n, bool usePacked) {
+        if (n != size() || usePacked != packed) resize(n, usePacked);
+    }
+    
+    // Troca o formato preservando o conteúdo
+    void setPacked(bool usePacked) {
+        if (usePacked == packed) return;
+        ReservoirBuffer converted;
+        converted.resize(size(), usePacked);
+        for (size_t i = 0; i < size(); i++) converted.set(static_cast<int>(i), get(static_cast<int>(i)));
+        *this = converted;
+    }
+    
+    void swap(ReservoirBuffer& other) {
+        std::swap(packed, other.packed);
+        full.swap(other.full);
+        compact.swap(other.compact);
+    }
+    
+    size_t size() const { return packed ? compact.size() : full.size(); }
+    size_t bytesPerPixel() const { return packed ? sizeof(PackedReservoir) : sizeof(Reservoir); }
+    
+    Reservoir get(int i) const { return packed ? compact[i].unpack(i) : full[i]; }
+    void set(int i, const Reservoir& r) {
+        if (packed) compact[i] = PackedReservoir::pack(r);
+        else full[i] = r;
+    }
+};
+
+// Checkpoint de reservatórios em disco (versão 1): cabeçalho seguido de um
+// registro por pixel, em ordem de linhas. Os registros são o formato em uso
+// no quadro (float ou compacto), então a retomada é exata nos dois casos.
+struct ReservoirCheckpointHeader {
+    char magic[8];              // "RSTRCKPT"
+    unsigned int version;
+    unsigned int byteOrder;     // 0x01020304 na ordem de bytes de quem gravou
+    unsigned int width;
+    unsigned int height;
+    unsigned int seed;
+    unsigned int frameIndex;    // próximo quadro a renderizar (continua os fluxos aleatórios)
+    unsigned int packed;        // 1 = PackedReservoir, 0 = ReservoirRecord
+    unsigned int recordSize;
+    unsigned long long sceneHash;
+    
+    static const unsigned int VERSION = 1;
+    static const unsigned int BYTE_ORDER_MARK = 0x01020304;
+};
+
+// Registro float de 16 bytes (pixelOrigin é implícito: o índice do registro)
+struct ReservoirRecord {
+    int lightIndex;
+    int M;
+    float targetPdf;
+    float weight;
+};
+
+// IMPLEMENTAÇÃO CORRIGIDA: Combinação MIS conforme Algoritmo 6 do artigo.
+// Versão em fluxo: os reservatórios de entrada chegam um a um por add(), sem
+// vetores intermediários, então o laço por pixel não aloca nada no heap.
+class UnbiasedMISCombiner {
+public:
+    UnbiasedMISCombiner(int currentPixel, const PixelLighting& lighting, RandomStream& rng)
+        : lighting(lighting), rng(rng), totalM(0) {
+        s.pixelOrigin = currentPixel;
+    }
+    
+    void add(const Reservoir& r) {
+        if (r.lightIndex < 0 || r.M == 0) return;
+        
+        // Peso de reamostragem: targetPdf no pixel atual * W * M
+        float currentTargetPdf = lighting.targetPdf(r.lightIndex);
+        
+        // CORREÇÃO CRÍTICA: Usar o peso original do reservatório, não recalcular.
+        // Amostra ocluída (reutilização de visibilidade): entra em M, nunca é escolhida
+        float resamplingWeight = r.occluded() ? 0.0f : currentTargetPdf * static_cast<float>(r.M);
+        
+        // Atualização do reservatório usando weighted reservoir sampling
+        s.weight += resamplingWeight;
+        totalM += static_cast<float>(r.M);
+        
+        bool accepted = s.weight > EPSILON && rng.nextFloat() < resamplingWeight / s.weight;
+        if (accepted) {
+            s.lightIndex = r.lightIndex;
+            s.targetPdf = currentTargetPdf;
+        }
+        METRIC_COUNT(accepted ? COUNTER_COMBINE_ACCEPTED : COUNTER_COMBINE_REJECTED, 1);
+    }
+    
+    Reservoir finish() const {
+        Reservoir result = s;
+        result.M = static_cast<int>(totalM);
+        
+        // CORREÇÃO CRÍTICA: Peso final conforme RIS padrão, sem MIS adicional
+        if (result.lightIndex >= 0 && result.targetPdf > EPSILON && result.M > 0) {
+            // Peso RIS padrão: (1/targetPdf) * (wsum/M)
+            float W = (result.weight / static_cast<float>(result.M)) / result.targetPdf;
+            result.weight = W * result.targetPdf * static_cast<float>(result.M); // Reconstrói weight para consistência
+        } else {
+            result.weight = 0.0f;
+        }
+        return result;
+    }
+    
+private:
+    const PixelLighting& lighting;
+    RandomStream& rng;
+    Reservoir s;
+    float totalM;
+};
+
+// Combinação de um bloco de tamanho fixo (ex.: array na pilha)
+Reservoir combineReservoirsUnbiasedMISCorrected(
+    int currentPixel,
+    const Reservoir* inputReservoirs,
+    int count,
+    const vector<SurfacePoint>& surfacePoints,
+    const vector<Light>& lights,
+    RandomStream& rng
+) {
+    PixelLighting lighting(lights, surfacePoints[currentPixel]);
+    UnbiasedMISCombiner combiner(currentPixel, lighting, rng);
+    for (int i = 0; i < count; ++i) combiner.add(inputReservoirs[i]);
+    return combiner.finish();
+}
+
+// Interface antiga com vetores (pixelOrigins não entra no cálculo)
+Reservoir combineReservoirsUnbiasedMISCorrected(
+    int currentPixel,
+    const vector<Reservoir>& inputReservoirs,
+    const vector<int>& pixelOrigins,
+    const vector<SurfacePoint>& surfacePoints,
+    const vector<Light>& lights,
+    RandomStream& rng
+) {
+    (void)pixelOrigins;
+    if (inputReservoirs.empty()) return combineReservoirsUnbiasedMISCorrected(currentPixel, 0, 0, surfacePoints, lights, rng);
+    return combineReservoirsUnbiasedMISCorrected(currentPixel, &inputReservoirs[0], static_cast<int>(inputReservoirs.size()),
+                                                 surfacePoints, lights, rng);
+}
+
+// Formatos de saída: P3 (texto, legado), P6 (binário 8 bits) e PFM (float, HDR)
+enum ImageFormat {
+    IMAGE_FORMAT_P3 = 0,
+    IMAGE_FORMAT_P6 = 1,
+    IMAGE_FORMAT_PFM = 2
+};
+
+const char* imageExtension(ImageFormat format) {
+    return format == IMAGE_FORMAT_PFM ? ".pfm" : ".ppm";
 }
 
-// Classe para carregar imagem PPM
+// Codificação de imagens em memória: o arquivo inteiro (ou uma faixa) vira um
+// bloco de bytes gravado com uma única chamada write()
+class ImageEncoder {
+public:
+    static string header(ImageFormat format, int width, int height) {
+        ostringstream oss;
+        if (format == IMAGE_FORMAT_PFM) {
+            oss << "PF\n" << width << " " << height << "\n-1.0\n"; // escala negativa = little-endian
+        } else {
+            oss << (format == IMAGE_FORMAT_P6 ? "P6" : "P3") << "\n" << width << " " << height << "\n255\n";
+        }
+        return oss.str();
+    }
+    
+    // Quantiza "count" pixels para RGB de 8 bits: mesma regra de Color::clamp()
+    // seguida de (int)(c * 255). Color é AoS de 3 floats, então a linha é tratada
+    // como um vetor contínuo de floats, 16 por vez com SSE2.
+    static void quantizeRGB8(const Color* pixels, size_t count, unsigned char* out) {
+        const float* values = &pixels[0].r;
+        size_t total = count * 3;
+        size_t i = 0;
+#ifdef RESTIR_X86
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 scale = _mm_set1_ps(255.0f);
+        for (; i + 16 <= total; i += 16) {
+            // max(v, 0) devolve 0 para NaN, como std::max(0.0f, v)
+            __m128i a = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(values + i), zero), one), scale));
+            __m128i b = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(values + i + 4), zero), one), scale));
+            __m128i c = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(values + i + 8), zero), one), scale));
+            __m128i d = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(values + i + 12), zero), one), scale));
+            __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), bytes);
+        }
+#endif
+        for (; i < total; i++) {
+            out[i] = static_cast<unsigned char>(static_cast<int>(min(1.0f, max(0.0f, values[i])) * 255));
+        }
+    }
+    
+    // Acrescenta "rows" linhas de "width" pixels em "out". O PFM guarda as linhas
+    // de baixo para cima, então o bloco é gravado invertido: quem escreve o
+    // arquivo em partes deve entregá-las da última para a primeira.
+    static void appendRows(ImageFormat format, const Color* pixels, int width, int rows, vector<unsigned char>& out) {
+        size_t rowPixels = static_cast<size_t>(width);
+        if (format == IMAGE_FORMAT_P3) {
+            ostringstream oss;
+            for (int y = 0; y < rows; y++) {
+                for (size_t x = 0; x < rowPixels; x++) {
+                    Color pixel = pixels[y * rowPixels + x];
+                    pixel.clamp();
+                    oss << static_cast<int>(pixel.r * 255) << " " << static_cast<int>(pixel.g * 255) << " "
+                        << static_cast<int>(pixel.b * 255) << " ";
+                }
+                oss << "\n";
+            }
+            string text = oss.str();
+            out.insert(out.end(), text.begin(), text.end());
+        } else if (format == IMAGE_FORMAT_P6) {
+            size_t offset = out.size();
+            out.resize(offset + rows * rowPixels * 3);
+            quantizeRGB8(pixels, rows * rowPixels, &out[offset]);
+        } else {
+            // Color já é r, g, b em float: cada linha é copiada como está
+            size_t rowBytes = rowPixels * sizeof(Color);
+            size_t offset = out.size();
+            out.resize(offset + rows * rowBytes);
+            for (int y = 0; y < rows; y++) {
+                memcpy(&out[offset + (rows - 1 - y) * rowBytes], &pixels[y * rowPixels], rowBytes);
+            }
+        }
+    }
+};
+
+// Gravação em segundo plano: submit() entrega um bloco já codificado a uma
+// thread de E/S e retorna; o próximo submit() (ou wait()) espera o anterior.
+// Com no máximo uma gravação pendente a memória extra é de um arquivo, e a
+// ordem dos blocos (necessária nos acréscimos do modo em faixas) é preservada.
+// submitImage() leva também a codificação para a thread de E/S. Os buffers
+// trocam de dono por swap, sem cópias: o chamador recebe de volta os da
+// gravação anterior, já concluída, com a capacidade preservada.
+class BackgroundImageWriter {
+public:
+    BackgroundImageWriter() : running(false), append(false), success(true), encodeImage(false),
+                              imageFormat(IMAGE_FORMAT_P6), imageWidth(0), imageHeight(0) {}
+    ~BackgroundImageWriter() { wait(); }
+    
+    // "data" é trocado (swap) com o buffer interno: o chamador fica com um vetor
+    // vazio (com a capacidade do bloco anterior)
+    void submit(const string& filename, vector<unsigned char>& data, bool appendToFile) {
+        wait();
+        pendingFilename = filename;
+        pendingData.swap(data);
+        append = appendToFile;
+        encodeImage = false;
+        start();
+    }
+    
+    // Imagem inteira em float, codificada em "format" na thread de E/S. "pixels" é
+    // trocado com a imagem da gravação anterior: ao renderizar nele o próximo
+    // quadro, o chamador alterna entre dois buffers sem alocar nem copiar
+    void submitImage(const string& filename, vector<Color>& pixels, ImageFormat format, int width, int height) {
+        wait();
+        pendingFilename = filename;
+        pendingImage.swap(pixels);
+        append = false;
+        encodeImage = true;
+        imageFormat = format;
+        imageWidth = width;
+        imageHeight = height;
+        start();
+    }
+    
+    // Bloqueia até a gravação pendente terminar; retorna se ela teve sucesso
+    bool wait() {
+        if (running) {
+#ifdef _WIN32
+            WaitForSingleObject(thread, INFINITE);
+            CloseHandle(thread);
+#else
+            pthread_join(thread, NULL);
+#endif
+            running = false;
+        }
+        return success;
+    }
+    
+private:
+    void start() {
+#ifdef _WIN32
+        thread = CreateThread(NULL, 0, threadMain, this, 0, NULL);
+        running = (thread != NULL);
+#else
+        running = (pthread_create(&thread, NULL, threadMain, this) == 0);
+#endif
+        if (!running) writePending(); // sem thread: grava de forma síncrona
+    }
+    
+#ifdef _WIN32
+    HANDLE thread;
+    static DWORD WINAPI threadMain(LPVOID self) {
+        static_cast<BackgroundImageWriter*>(self)->writePending();
+        return 0;
+    }
+#else
+    pthread_t thread;
+    static void* threadMain(void* self) {
+        static_cast<BackgroundImageWriter*>(self)->writePending();
+        return NULL;
+    }
+#endif
+    
+    void writePending() {
+        METRIC_CLOCK(writeStart);
+        if (encodeImage) {
+            string header = ImageEncoder::header(imageFormat, imageWidth, imageHeight);
+            pendingData.assign(header.begin(), header.end());
+            ImageEncoder::appendRows(imageFormat, &pendingImage[0], imageWidth, imageHeight, pendingData);
+        }
+        FILE* file = fopen(pendingFilename.c_str(), append ? "ab" : "wb");
+        success = (file != NULL);
+        if (file) {
+            if (!pendingData.empty()) success = fwrite(&pendingData[0], 1, pendingData.size(), file) == pendingData.size();
+            success = (fclose(file) == 0) && success;
+        }
+        if (!success) cerr << "Erro ao gravar arquivo " << pendingFilename << endl;
+        pendingData.clear();
+        METRIC_BACKGROUND_IO(wallTime() - writeStart);
+    }
+    
+    // Não copiável: a thread guarda um ponteiro para este objeto
+    BackgroundImageWriter(const BackgroundImageWriter&);
+    BackgroundImageWriter& operator=(const BackgroundImageWriter&);
+    
+    bool running;
+    bool append;
+    bool success;
+    string pendingFilename;
+    vector<unsigned char> pendingData;
+    bool encodeImage;
+    ImageFormat imageFormat;
+    int imageWidth;
+    int imageHeight;
+    vector<Color> pendingImage;
+};
+
+// Arquivo mapeado em memória (somente leitura): o conteúdo é lido direto das
+// páginas do sistema, sem cópia para buffers intermediários
+class MappedFile {
+public:
+    MappedFile() : data(0), size(0) {
+#ifdef _WIN32
+        file = INVALID_HANDLE_VALUE;
+        mapping = NULL;
+#endif
+    }
+    ~MappedFile() { close(); }
+    
+    bool open(const string& filename) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                           FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) { close(); return false; }
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) { close(); return false; }
+        data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (!data) { close(); return false; }
+        size = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size <= 0) { ::close(fd); return false; }
+        void* mapped = mmap(0, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // o mapeamento continua válido
+        if (mapped == MAP_FAILED) return false;
+        madvise(mapped, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+        data = static_cast<const unsigned char*>(mapped);
+        size = static_cast<size_t>(info.st_size);
+#endif
+        return true;
+    }
+    
+    void close() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping != NULL) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data) munmap(const_cast<unsigned char*>(data), size);
+#endif
+        data = 0;
+        size = 0;
+    }
+    
+    const unsigned char* data;
+    size_t size;
+    
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+// Classe para carregar imagem PPM (P3, P6 de 8 ou 16 bits) ou PFM (PF/Pf).
+// O arquivo é mapeado em memória e cada linha é convertida para float direto
+// no buffer de destino; se a resolução difere da pedida, a imagem é
+// reamostrada bilinearmente a partir de um cache de duas linhas por thread.
 class PPMLoader {
 public:
-    static vector<Color> loadPPM(const string& filename, int& width, int& height) {
-        ifstream file(filename.c_str(), ios::binary);
-        vector<Color> image;
-        if (!file.is_open()) {
+    enum Encoding { TEXT_P3, BINARY_8, BINARY_16, FLOAT_RGB, FLOAT_GRAY };
+    
+    struct Header {
+        Encoding encoding;
+        int width;
+        int height;
+        int maxVal;          // PPM
+        bool littleEndian;   // PFM: escala negativa
+        size_t dataOffset;
+    };
+    
+    // targetWidth/targetHeight <= 0 mantém a resolução do arquivo
+    static bool load(const string& filename, int targetWidth, int targetHeight, vector<Color>& image,
+                     int& width, int& height) {
+        MappedFile file;
+        if (!file.open(filename)) {
             cerr << "Erro: Não foi possível abrir o arquivo " << filename << endl;
-            return image;
-        }
-        string magic;
-        file >> magic;
-        if (magic != "P3" && magic != "P6") {
-            cerr << "Erro: Formato PPM não suportado (apenas P3 e P6)" << endl;
-            file.close();
-            return image;
-        }
-        file >> width >> height;
-        int maxVal;
-        file >> maxVal;
-        if (maxVal <= 0 || maxVal > 255) {
-            cerr << "Erro: Valor máximo inválido no arquivo PPM" << endl;
-            file.close();
-            return image;
-        }
-        image.resize(width * height);
-        if (magic == "P3") {
-            for (int i = 0; i < width * height; i++) {
-                int r, g, b;
-                file >> r >> g >> b;
-                image[i] = Color(static_cast<float>(r) / static_cast<float>(maxVal),
-                                 static_cast<float>(g) / static_cast<float>(maxVal),
-                                 static_cast<float>(b) / static_cast<float>(maxVal));
+            return false;
+        }
+        Header header;
+        if (!parseHeader(file, header)) return false;
+        width = header.width;
+        height = header.height;
+        if (targetWidth <= 0 || targetHeight <= 0) {
+            targetWidth = width;
+            targetHeight = height;
+        }
+        
+        // P3 não permite acesso direto às linhas: decodifica inteiro e reamostra em memória
+        vector<Color> textPixels;
+        if (header.encoding == TEXT_P3 && !decodeText(file, header, textPixels)) return false;
+        const Color* textImage = textPixels.empty() ? 0 : &textPixels[0];
+        
+        image.resize(static_cast<size_t>(targetWidth) * targetHeight);
+        if (targetWidth == width && targetHeight == height) {
+            if (textImage) {
+                image.swap(textPixels);
+            } else {
+#pragma omp parallel for schedule(static)
+                for (int y = 0; y < height; y++) {
+                    decodeRow(file, header, y, &image[static_cast<size_t>(y) * width]);
+                }
             }
         } else {
-            file.ignore();
-            for (int i = 0; i < width * height; i++) {
-                unsigned char rgb[3];
-                file.read(reinterpret_cast<char*>(rgb), 3);
-                image[i] = Color(static_cast<float>(rgb[0]) / static_cast<float>(maxVal),
-                                 static_cast<float>(rgb[1]) / static_cast<float>(maxVal),
-                                 static_cast<float>(rgb[2]) / static_cast<float>(maxVal));
+            resampleBilinear(file, header, textImage, targetWidth, targetHeight, &image[0]);
+        }
+        cout << "Imagem baseline carregada: " << filename << " (" << width << "x" << height;
+        if (targetWidth != width || targetHeight != height) cout << " -> " << targetWidth << "x" << targetHeight << " bilinear";
+        cout << ")" << endl;
+        return true;
+    }
+    
+private:
+    // Lê um inteiro ou token do cabeçalho, pulando espaços e comentários "#"
+    static bool nextToken(const MappedFile& file, size_t& pos, string& token) {
+        while (pos < file.size) {
+            unsigned char c = file.data[pos];
+            if (c == '#') {
+                while (pos < file.size && file.data[pos] != '\n') pos++;
+            } else if (isspace(c)) {
+                pos++;
+            } else {
+                break;
+            }
+        }
+        size_t begin = pos;
+        while (pos < file.size && !isspace(file.data[pos])) pos++;
+        token.assign(reinterpret_cast<const char*>(file.data + begin), pos - begin);
+        return !token.empty();
+    }
+    
+    static bool parseHeader(const MappedFile& file, Header& header) {
+        size_t pos = 0;
+        string magic, widthToken, heightToken, lastToken;
+        if (!nextToken(file, pos, magic) || !nextToken(file, pos, widthToken) ||
+            !nextToken(file, pos, heightToken) || !nextToken(file, pos, lastToken)) {
+            cerr << "Erro: Cabeçalho de imagem incompleto" << endl;
+            return false;
+        }
+        header.width = atoi(widthToken.c_str());
+        header.height = atoi(heightToken.c_str());
+        header.maxVal = 0;
+        header.littleEndian = false;
+        header.dataOffset = pos + 1; // um único caractere de espaço antes dos dados
+        if (header.width <= 0 || header.height <= 0) {
+            cerr << "Erro: Dimensões inválidas no arquivo de imagem" << endl;
+            return false;
+        }
+        
+        size_t bytesPerSample;
+        if (magic == "PF" || magic == "Pf") {
+            double scale = atof(lastToken.c_str());
+            header.encoding = (magic == "PF") ? FLOAT_RGB : FLOAT_GRAY;
+            header.littleEndian = (scale < 0.0);
+            bytesPerSample = (magic == "PF") ? 12 : 4;
+        } else if (magic == "P3" || magic == "P6") {
+            header.maxVal = atoi(lastToken.c_str());
+            if (header.maxVal <= 0 || header.maxVal > 65535) {
+                cerr << "Erro: Valor máximo inválido no arquivo PPM" << endl;
+                return false;
+            }
+            header.encoding = (magic == "P3") ? TEXT_P3 : (header.maxVal > 255 ? BINARY_16 : BINARY_8);
+            bytesPerSample = (header.encoding == BINARY_16) ? 6 : 3;
+        } else {
+            cerr << "Erro: Formato de imagem não suportado (apenas P3, P6 e PFM)" << endl;
+            return false;
+        }
+        
+        if (header.encoding != TEXT_P3 &&
+            header.dataOffset + static_cast<size_t>(header.width) * header.height * bytesPerSample > file.size) {
+            cerr << "Erro: Arquivo de imagem truncado" << endl;
+            return false;
+        }
+        return true;
+    }
+    
+    static bool decodeText(const MappedFile& file, const Header& header, vector<Color>& image) {
+        size_t count = static_cast<size_t>(header.width) * header.height * 3;
+        image.resize(static_cast<size_t>(header.width) * header.height);
+        float* out = &image[0].r;
+        size_t pos = header.dataOffset;
+        for (size_t i = 0; i < count; i++) {
+            while (pos < file.size && isspace(file.data[pos])) pos++;
+            if (pos >= file.size) {
+                cerr << "Erro: Arquivo de imagem truncado" << endl;
+                return false;
+            }
+            // Cada amostra é um decimal até maxVal seguido de espaço ou do fim do arquivo
+            size_t begin = pos;
+            int value = 0;
+            while (pos < file.size && file.data[pos] >= '0' && file.data[pos] <= '9' && value <= header.maxVal) {
+                value = value * 10 + (file.data[pos++] - '0');
+            }
+            if (pos == begin || value > header.maxVal || (pos < file.size && !isspace(file.data[pos]))) {
+                cerr << "Erro: Amostra P3 inválida na posição " << begin << endl;
+                return false;
+            }
+            out[i] = static_cast<float>(value) / static_cast<float>(header.maxVal);
+        }
+        return true;
+    }
+    
+    // Converte a linha "y" (de cima para baixo) para "width" pixels em "out"
+    static void decodeRow(const MappedFile& file, const Header& header, int y, Color* out) {
+        size_t count = static_cast<size_t>(header.width) * 3;
+        float* values = &out[0].r;
+        const float maxVal = static_cast<float>(header.maxVal);
+        if (header.encoding == BINARY_8) {
+            const unsigned char* src = file.data + header.dataOffset + y * count;
+            size_t i = 0;
+#ifdef RESTIR_X86
+            const __m128i zero = _mm_setzero_si128();
+            const __m128 divisor = _mm_set1_ps(maxVal);
+            for (; i + 16 <= count; i += 16) {
+                __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+                __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+                _mm_storeu_ps(values + i, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), divisor));
+                _mm_storeu_ps(values + i + 4, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), divisor));
+                _mm_storeu_ps(values + i + 8, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), divisor));
+                _mm_storeu_ps(values + i + 12, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), divisor));
+            }
+#endif
+            for (; i < count; i++) values[i] = static_cast<float>(src[i]) / maxVal;
+        } else if (header.encoding == BINARY_16) {
+            // Amostras de 16 bits em big-endian
+            const unsigned char* src = file.data + header.dataOffset + y * count * 2;
+            size_t i = 0;
+#ifdef RESTIR_X86
+            const __m128i zero = _mm_setzero_si128();
+            const __m128 divisor = _mm_set1_ps(maxVal);
+            for (; i + 8 <= count; i += 8) {
+                __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+                words = _mm_or_si128(_mm_slli_epi16(words, 8), _mm_srli_epi16(words, 8));
+                _mm_storeu_ps(values + i, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero)), divisor));
+                _mm_storeu_ps(values + i + 4, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero)), divisor));
+            }
+#endif
+            for (; i < count; i++) values[i] = static_cast<float>((src[2 * i] << 8) | src[2 * i + 1]) / maxVal;
+        } else {
+            // PFM: linhas de baixo para cima; floats de 32 bits na ordem indicada pela escala
+            int channels = (header.encoding == FLOAT_RGB) ? 3 : 1;
+            size_t rowBytes = static_cast<size_t>(header.width) * channels * 4;
+            const unsigned char* src = file.data + header.dataOffset + (header.height - 1 - y) * rowBytes;
+            unsigned int probe = 1;
+            bool hostLittleEndian = (*reinterpret_cast<unsigned char*>(&probe) == 1);
+            if (channels == 3 && header.littleEndian == hostLittleEndian) {
+                memcpy(values, src, rowBytes);
+                return;
+            }
+            for (int x = 0; x < header.width; x++) {
+                for (int c = 0; c < 3; c++) {
+                    const unsigned char* b = src + (static_cast<size_t>(x) * channels + (channels == 3 ? c : 0)) * 4;
+                    unsigned int bits = header.littleEndian
+                        ? (b[0] | (b[1] << 8) | (b[2] << 16) | (static_cast<unsigned int>(b[3]) << 24))
+                        : (b[3] | (b[2] << 8) | (b[1] << 16) | (static_cast<unsigned int>(b[0]) << 24));
+                    memcpy(&values[x * 3 + c], &bits, 4);
+                }
             }
         }
-        file.close();
-        cout << "Imagem baseline carregada: " << filename << " (" << width << "x" << height << ")" << endl;
-        return image;
+    }
+    
+    // Reamostragem bilinear (centros de pixel alinhados). Cada thread percorre um
+    // bloco contínuo de linhas de destino e mantém decodificadas só as duas
+    // linhas de origem que interpola.
+    static void resampleBilinear(const MappedFile& file, const Header& header, const Color* textImage,
+                                 int targetWidth, int targetHeight, Color* out) {
+        int srcWidth = header.width;
+        int srcHeight = header.height;
+        float scaleX = static_cast<float>(srcWidth) / targetWidth;
+        float scaleY = static_cast<float>(srcHeight) / targetHeight;
+        
+        // Colunas de origem e pesos são iguais para todas as linhas
+        vector<int> x0(targetWidth), x1(targetWidth);
+        vector<float> fx(targetWidth);
+        for (int x = 0; x < targetWidth; x++) {
+            float sx = min(static_cast<float>(srcWidth - 1), max(0.0f, (x + 0.5f) * scaleX - 0.5f));
+            x0[x] = static_cast<int>(sx);
+            x1[x] = min(x0[x] + 1, srcWidth - 1);
+            fx[x] = sx - x0[x];
+        }
+        
+#pragma omp parallel
+        {
+            vector<Color> rows[2];
+            int cachedRow[2] = { -1, -1 };
+            if (!textImage) {
+                rows[0].resize(srcWidth);
+                rows[1].resize(srcWidth);
+            }
+#pragma omp for schedule(static)
+            for (int y = 0; y < targetHeight; y++) {
+                float sy = min(static_cast<float>(srcHeight - 1), max(0.0f, (y + 0.5f) * scaleY - 0.5f));
+                int y0 = static_cast<int>(sy);
+                int y1 = min(y0 + 1, srcHeight - 1);
+                float fy = sy - y0;
+                const Color* row[2];
+                int wanted[2] = { y0, y1 };
+                for (int k = 0; k < 2; k++) {
+                    if (textImage) {
+                        row[k] = textImage + static_cast<size_t>(wanted[k]) * srcWidth;
+                        continue;
+                    }
+                    int slot = (cachedRow[0] == wanted[k]) ? 0 : (cachedRow[1] == wanted[k]) ? 1 : -1;
+                    if (slot < 0) {
+                        // Não descarta a outra linha de que esta interpolação precisa
+                        slot = (cachedRow[0] == wanted[1 - k]) ? 1 : 0;
+                        decodeRow(file, header, wanted[k], &rows[slot][0]);
+                        cachedRow[slot] = wanted[k];
+                    }
+                    row[k] = &rows[slot][0];
+                }
+                Color* dst = out + static_cast<size_t>(y) * targetWidth;
+                for (int x = 0; x < targetWidth; x++) {
+                    Color top = row[0][x0[x]] * (1.0f - fx[x]) + row[0][x1[x]] * fx[x];
+                    Color bottom = row[1][x0[x]] * (1.0f - fx[x]) + row[1][x1[x]] * fx[x];
+                    dst[x] = top * (1.0f - fy) + bottom * fy;
+                }
+            }
+        }
+    }
+};
+
+// Câmera ortográfica: um raio por pixel, paralelo a "forward", com origem no
+// plano da câmera. A câmera padrão (0,0,100) -> (0,0,0) mapeia o pixel (x, y)
+// para (x - WIDTH/2, y - HEIGHT/2) no mundo.
+struct OrthoCamera {
+    Vec3 position;
+    Vec3 forward;
+    Vec3 right;
+    Vec3 up;
+    
+    OrthoCamera() : position(0, 0, 100), forward(0, 0, -1), right(1, 0, 0), up(0, 1, 0) {}
+    OrthoCamera(const Vec3& pos, const Vec3& target) : position(pos) {
+        forward = (target - pos).normalize();
+        right = forward.cross(Vec3(0, 1, 0)).normalize();
+        up = right.cross(forward);
+    }
+    
+    Vec3 rayOrigin(float x, float y) const {
+        return position + right * (x - WIDTH/2) + up * (y - HEIGHT/2);
+    }
+    
+    // Coordenadas de pixel (contínuas) do ponto do mundo
+    void project(const Vec3& point, float& x, float& y) const {
+        Vec3 local = point - position;
+        x = local.dot(right) + WIDTH/2;
+        y = local.dot(up) + HEIGHT/2;
     }
 };
 
@@ -344,10 +2242,18 @@ class Scene {
 public:
     vector<Light> lights;
     vector<Sphere> spheres;
+    SphereBVH sphereBVH;
     Vec3 cameraPos;
     Vec3 cameraTarget;
+    unsigned int geometryVersion; // Incrementada a cada reconstrução da geometria
+    unsigned int lightsVersion;   // Incrementada a cada alteração do conjunto de luzes
+    UniformLightSampler uniformLightSampler;
+    AliasLightSampler aliasLightSampler;
+    LightTreeSampler lightTreeSampler;
+    LightSamplingType lightSamplingType;
+    LightSoA lightSoA;
     
-    Scene() : cameraPos(0, 0, 100), cameraTarget(0, 0, 0) {}
+    Scene() : cameraPos(0, 0, 100), cameraTarget(0, 0, 0), geometryVersion(0), lightsVersion(0), lightSamplingType(LIGHT_SAMPLING_UNIFORM) {}
     
     void setupLights() {
         lights.clear();
@@ -362,6 +2268,63 @@ public:
         lights.push_back(Light(Vec3(400, 0, 180), Color(1.0f, 0.3f, 0.6f), 500));
         
         cout << "Total de luzes otimizadas: " << lights.size() << " (configuradas para demonstrar diferenças BIASED/UNBIASED)" << endl;
+        buildLightSampler();
+    }
+    
+    // Cena sintética com muitas luzes pontuais sobre o plano (potência total
+    // equivalente à das 7 luzes padrão), usada nos benchmarks de amostragem
+    void setupRandomLights(int count, unsigned int seed) {
+        lights.clear();
+        RandomStream rng(seed, 0, 0, static_cast<unsigned int>(count));
+        float intensity = 4100.0f / static_cast<float>(count);
+        for (int i = 0; i < count; i++) {
+            Vec3 position((rng.nextFloat() - 0.5f) * WIDTH * 1.5f, (rng.nextFloat() - 0.5f) * HEIGHT * 1.5f,
+                          30.0f + rng.nextFloat() * 220.0f);
+            Color color(0.2f + 0.8f * rng.nextFloat(), 0.2f + 0.8f * rng.nextFloat(), 0.2f + 0.8f * rng.nextFloat());
+            lights.push_back(Light(position, color, intensity * (0.25f + 1.5f * rng.nextFloat())));
+        }
+        buildLightSampler();
+    }
+    
+    // Deve ser chamada sempre que "lights" for alterado
+    void buildLightSampler() {
+        METRIC_PHASE(PHASE_SCENE_BUILD);
+        lightsVersion++;
+        lightSoA.build(lights);
+        uniformLightSampler.build(lights);
+        aliasLightSampler.build(lights);
+        lightTreeSampler.build(lights);
+        lightSamplingType = static_cast<LightSamplingType>(LIGHT_SAMPLING);
+    }
+    
+    const LightSampler& lightSampler() const {
+        if (lightSamplingType == LIGHT_SAMPLING_ALIAS) return aliasLightSampler;
+        if (lightSamplingType == LIGHT_SAMPLING_TREE) return lightTreeSampler;
+        return uniformLightSampler;
+    }
+    
+    // Hash FNV-1a de luzes, esferas e câmera: identifica a cena de um checkpoint
+    unsigned long long contentHash() const {
+        unsigned long long hash = 14695981039346656037ULL;
+        vector<float> values;
+        for (size_t i = 0; i < lights.size(); i++) {
+            const Light& l = lights[i];
+            float v[7] = { l.position.x, l.position.y, l.position.z, l.color.r, l.color.g, l.color.b, l.intensity };
+            values.insert(values.end(), v, v + 7);
+        }
+        for (size_t i = 0; i < spheres.size(); i++) {
+            const Sphere& sp = spheres[i];
+            float v[7] = { sp.center.x, sp.center.y, sp.center.z, sp.radius, sp.albedo.r, sp.albedo.g, sp.albedo.b };
+            values.insert(values.end(), v, v + 7);
+        }
+        float camera[6] = { cameraPos.x, cameraPos.y, cameraPos.z, cameraTarget.x, cameraTarget.y, cameraTarget.z };
+        values.insert(values.end(), camera, camera + 6);
+        unsigned int counts[2] = { static_cast<unsigned int>(lights.size()), static_cast<unsigned int>(spheres.size()) };
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(counts);
+        for (size_t i = 0; i < sizeof(counts); i++) hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        bytes = reinterpret_cast<const unsigned char*>(&values[0]);
+        for (size_t i = 0; i < values.size() * sizeof(float); i++) hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        return hash;
     }
     
     void setupSpheres() {
@@ -385,48 +2348,761 @@ public:
         }
         
         cout << "Total de esferas otimizadas: " << spheres.size() << " (albedo 0.95 para máximo contraste)" << endl;
+        buildAccelerationStructure();
+    }
+    
+    // Deve ser chamada sempre que "spheres" for alterado
+    void buildAccelerationStructure() {
+        METRIC_PHASE(PHASE_SCENE_BUILD);
+        sphereBVH.build(spheres);
+        geometryVersion++;
+    }
+    
+    int intersectSpheres(const Vec3& rayOrigin, const Vec3& rayDir, float& closestDistance) const {
+        return sphereBVH.intersect(rayOrigin, rayDir, closestDistance);
+    }
+    
+    bool occluded(const Vec3& rayOrigin, const Vec3& rayDir, float maxDistance) const {
+        return sphereBVH.occluded(rayOrigin, rayDir, maxDistance);
+    }
+    
+    // Versão força bruta, mantida como referência para validação e benchmark
+    int intersectSpheresLinear(const Vec3& rayOrigin, const Vec3& rayDir, float& closestDistance) const {
+        closestDistance = 1e30f;
+        int closestSphere = -1;
+        for (int i = 0; i < static_cast<int>(spheres.size()); i++) {
+            float distance = spheres[i].intersect(rayOrigin, rayDir);
+            if (distance > 0 && distance < closestDistance) {
+                closestDistance = distance;
+                closestSphere = i;
+            }
+        }
+        return closestSphere;
+    }
+};
+
+// Cabeçalho do formato binário de cena (.rscn). Seguem, em float e nesta
+// ordem, arranjos SoA de sphereCount entradas (centro x, y, z, raio, albedo
+// r, g, b) e de lightCount entradas (posição x, y, z, cor r, g, b, intensidade).
+// Tudo fica alinhado a 4 bytes, então os arranjos são lidos direto do mapeamento.
+struct SceneFileHeader {
+    char magic[8];              // "RSTRSCNE"
+    unsigned int version;
+    unsigned int byteOrder;     // 0x01020304 na ordem de bytes de quem gravou
+    unsigned int sphereCount;
+    unsigned int lightCount;
+    float camera[6];            // posição e alvo da câmera
+    
+    static const unsigned int VERSION = 1;
+    static const unsigned int BYTE_ORDER_MARK = 0x01020304;
+    static const int SPHERE_ARRAYS = 7;
+    static const int LIGHT_ARRAYS = 7;
+};
+
+// Entrada de cenas (--scene): texto para cenas escritas à mão ou binário
+// mapeado em memória para milhões de primitivas. O formato é reconhecido pelo
+// cabeçalho. No texto, uma primitiva por linha ('#' inicia comentário):
+//   camera px py pz tx ty tz
+//   sphere cx cy cz raio r g b
+//   light x y z r g b intensidade
+// O plano xadrez continua fazendo parte da cena.
+class SceneFile {
+public:
+    static bool load(const string& filename, Scene& scene) {
+        double start = wallTime();
+        bool loaded;
+        {
+            METRIC_PHASE(PHASE_SCENE_LOAD);
+            MappedFile file;
+            if (!file.open(filename)) {
+                cerr << "Erro: Não foi possível abrir a cena " << filename << endl;
+                return false;
+            }
+            bool binary = file.size >= 8 && memcmp(file.data, "RSTRSCNE", 8) == 0;
+            loaded = binary ? loadBinary(file, filename, scene) : loadText(file, filename, scene);
+        }
+        if (!loaded) return false;
+        if (scene.lights.empty()) {
+            cerr << "Erro: a cena " << filename << " não tem luzes" << endl;
+            return false;
+        }
+        double loadSeconds = wallTime() - start;
+        scene.buildLightSampler();
+        scene.buildAccelerationStructure();
+        double buildSeconds = wallTime() - start - loadSeconds;
+        cout << "Cena carregada de " << filename << ": " << scene.spheres.size() << " esferas, "
+             << scene.lights.size() << " luzes (leitura " << fixed << setprecision(1) << loadSeconds * 1000.0
+             << " ms, BVH e amostradores " << buildSeconds * 1000.0 << " ms)" << endl;
+        cout.unsetf(ios::fixed);
+        return true;
+    }
+    
+    static bool saveBinary(const string& filename, const Scene& scene) {
+        SceneFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "RSTRSCNE", 8);
+        header.version = SceneFileHeader::VERSION;
+        header.byteOrder = SceneFileHeader::BYTE_ORDER_MARK;
+        header.sphereCount = static_cast<unsigned int>(scene.spheres.size());
+        header.lightCount = static_cast<unsigned int>(scene.lights.size());
+        float camera[6] = { scene.cameraPos.x, scene.cameraPos.y, scene.cameraPos.z,
+                            scene.cameraTarget.x, scene.cameraTarget.y, scene.cameraTarget.z };
+        memcpy(header.camera, camera, sizeof(camera));
+        
+        size_t spheres = scene.spheres.size(), lights = scene.lights.size();
+        vector<float> data(SceneFileHeader::SPHERE_ARRAYS * spheres + SceneFileHeader::LIGHT_ARRAYS * lights);
+        for (size_t i = 0; i < spheres; i++) {
+            const Sphere& sphere = scene.spheres[i];
+            float values[SceneFileHeader::SPHERE_ARRAYS] = { sphere.center.x, sphere.center.y, sphere.center.z, sphere.radius,
+                                                             sphere.albedo.r, sphere.albedo.g, sphere.albedo.b };
+            for (int a = 0; a < SceneFileHeader::SPHERE_ARRAYS; a++) data[a * spheres + i] = values[a];
+        }
+        float* lightData = data.empty() ? 0 : &data[SceneFileHeader::SPHERE_ARRAYS * spheres];
+        for (size_t i = 0; i < lights; i++) {
+            const Light& light = scene.lights[i];
+            float values[SceneFileHeader::LIGHT_ARRAYS] = { light.position.x, light.position.y, light.position.z,
+                                                            light.color.r, light.color.g, light.color.b, light.intensity };
+            for (int a = 0; a < SceneFileHeader::LIGHT_ARRAYS; a++) lightData[a * lights + i] = values[a];
+        }
+        
+        ofstream file(filename.c_str(), ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!data.empty()) file.write(reinterpret_cast<const char*>(&data[0]), data.size() * sizeof(float));
+        if (!file) {
+            cerr << "Erro: não foi possível gravar a cena em " << filename << endl;
+            return false;
+        }
+        cout << "Cena gravada em " << filename << " (" << spheres << " esferas, " << lights << " luzes)" << endl;
+        return true;
+    }
+    
+private:
+    static bool loadBinary(const MappedFile& file, const string& filename, Scene& scene) {
+        SceneFileHeader header;
+        if (file.size < sizeof(header)) {
+            cerr << "Erro: cena " << filename << " truncada" << endl;
+            return false;
+        }
+        memcpy(&header, file.data, sizeof(header));
+        if (header.byteOrder != SceneFileHeader::BYTE_ORDER_MARK || header.version != SceneFileHeader::VERSION) {
+            cerr << "Erro: cena " << filename << " com versão ou ordem de bytes incompatível" << endl;
+            return false;
+        }
+        size_t spheres = header.sphereCount, lights = header.lightCount;
+        size_t expected = sizeof(header) + (SceneFileHeader::SPHERE_ARRAYS * spheres +
+                                            SceneFileHeader::LIGHT_ARRAYS * lights) * sizeof(float);
+        if (file.size < expected) {
+            cerr << "Erro: cena " << filename << " truncada (" << file.size << " de " << expected << " bytes)" << endl;
+            return false;
+        }
+        
+        const float* sphereData = reinterpret_cast<const float*>(file.data + sizeof(header));
+        const float* lightData = sphereData + SceneFileHeader::SPHERE_ARRAYS * spheres;
+        scene.spheres.resize(spheres);
+        scene.lights.resize(lights);
+        int sphereCount = static_cast<int>(spheres), lightCount = static_cast<int>(lights);
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < sphereCount; i++) {
+            const float* a = sphereData + i;
+            scene.spheres[i] = Sphere(Vec3(a[0], a[spheres], a[2 * spheres]), a[3 * spheres],
+                                      Color(a[4 * spheres], a[5 * spheres], a[6 * spheres]));
+        }
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < lightCount; i++) {
+            const float* a = lightData + i;
+            scene.lights[i] = Light(Vec3(a[0], a[lights], a[2 * lights]), Color(a[3 * lights], a[4 * lights], a[5 * lights]),
+                                    a[6 * lights]);
+        }
+        scene.cameraPos = Vec3(header.camera[0], header.camera[1], header.camera[2]);
+        scene.cameraTarget = Vec3(header.camera[3], header.camera[4], header.camera[5]);
+        return true;
+    }
+    
+    static bool loadText(const MappedFile& file, const string& filename, Scene& scene) {
+        scene.spheres.clear();
+        scene.lights.clear();
+        istringstream input(string(reinterpret_cast<const char*>(file.data), file.size));
+        string line;
+        int lineNumber = 0;
+        while (getline(input, line)) {
+            lineNumber++;
+            size_t comment = line.find('#');
+            if (comment != string::npos) line = line.substr(0, comment);
+            istringstream fields(line);
+            string kind;
+            if (!(fields >> kind)) continue;
+            float v[7];
+            int expected = (kind == "camera") ? 6 : 7;
+            int read = 0;
+            while (read < expected && fields >> v[read]) read++;
+            string extra;
+            if ((kind != "camera" && kind != "sphere" && kind != "light") || read != expected || fields >> extra) {
+                cerr << "Erro: " << filename << ":" << lineNumber << ": linha inválida: " << line << endl;
+                return false;
+            }
+            if (kind == "camera") {
+                scene.cameraPos = Vec3(v[0], v[1], v[2]);
+                scene.cameraTarget = Vec3(v[3], v[4], v[5]);
+            } else if (kind == "sphere") {
+                scene.spheres.push_back(Sphere(Vec3(v[0], v[1], v[2]), v[3], Color(v[4], v[5], v[6])));
+            } else {
+                scene.lights.push_back(Light(Vec3(v[0], v[1], v[2]), Color(v[3], v[4], v[5]), v[6]));
+            }
+        }
+        return true;
+    }
+};
+
+// Trajetória por quadros-chave com interpolação linear, cíclica em t (t e t+1
+// são o mesmo ponto). Os tempos dos quadros-chave ficam em [0, 1).
+class KeyframedPath {
+public:
+    vector<float> times;
+    vector<Vec3> values;
+    
+    void add(float time, const Vec3& value) {
+        times.push_back(time);
+        values.push_back(value);
+    }
+    
+    Vec3 evaluate(float t) const {
+        if (values.empty()) return Vec3(0, 0, 0);
+        t -= floor(t);
+        size_t count = times.size();
+        size_t next = 0;
+        while (next < count && times[next] <= t) next++;
+        size_t prev = (next + count - 1) % count;
+        if (next == count) next = 0;
+        float t0 = times[prev];
+        float t1 = times[next];
+        if (t1 <= t0) t1 += 1.0f;
+        if (t < t0) t += 1.0f;
+        float span = t1 - t0;
+        float alpha = span > 0 ? (t - t0) / span : 0.0f;
+        return values[prev] * (1.0f - alpha) + values[next] * alpha;
+    }
+};
+
+// Animação da cena no modo sequência (--frames): a câmera translada, as luzes
+// percorrem um quadrado e as esferas oscilam, cada uma com fase própria. As
+// trajetórias são deslocamentos sobre o estado capturado em capture().
+class SceneAnimation {
+public:
+    KeyframedPath cameraPath;
+    KeyframedPath lightPath;
+    KeyframedPath spherePath;
+    vector<Vec3> baseLights;
+    vector<Vec3> baseSpheres;
+    Vec3 baseCameraPos;
+    Vec3 baseCameraTarget;
+    
+    SceneAnimation() {
+        cameraPath.add(0.0f, Vec3(0, 0, 0));
+        cameraPath.add(0.25f, Vec3(40, 0, 0));
+        cameraPath.add(0.5f, Vec3(40, 30, 0));
+        cameraPath.add(0.75f, Vec3(0, 30, 0));
+        
+        lightPath.add(0.0f, Vec3(-100, -100, 0));
+        lightPath.add(0.25f, Vec3(100, -100, 0));
+        lightPath.add(0.5f, Vec3(100, 100, 0));
+        lightPath.add(0.75f, Vec3(-100, 100, 0));
+        
+        spherePath.add(0.0f, Vec3(0, 0, 0));
+        spherePath.add(0.5f, Vec3(12, 6, 10));
+    }
+    
+    void capture(const Scene& scene) {
+        baseLights.clear();
+        baseSpheres.clear();
+        for (size_t i = 0; i < scene.lights.size(); i++) baseLights.push_back(scene.lights[i].position);
+        for (size_t i = 0; i < scene.spheres.size(); i++) baseSpheres.push_back(scene.spheres[i].center);
+        baseCameraPos = scene.cameraPos;
+        baseCameraTarget = scene.cameraTarget;
+    }
+    
+    // Posiciona a cena no instante t em [0, 1) e reconstrói amostrador e BVH
+    void apply(Scene& scene, float t) const {
+        Vec3 cameraOffset = cameraPath.evaluate(t);
+        scene.cameraPos = baseCameraPos + cameraOffset;
+        scene.cameraTarget = baseCameraTarget + cameraOffset;
+        
+        size_t lightCount = min(baseLights.size(), scene.lights.size());
+        for (size_t i = 0; i < lightCount; i++) {
+            float phase = static_cast<float>(i) / static_cast<float>(lightCount);
+            scene.lights[i].position = baseLights[i] + lightPath.evaluate(t + phase);
+        }
+        size_t sphereCount = min(baseSpheres.size(), scene.spheres.size());
+        for (size_t i = 0; i < sphereCount; i++) {
+            scene.spheres[i].center = baseSpheres[i] + spherePath.evaluate(t + static_cast<float>(i) * 0.618f);
+        }
+        scene.buildLightSampler();
+        scene.buildAccelerationStructure();
+    }
+};
+
+// Cache por pixel da avaliação de todas as luzes (targetPdf + RGB), em layout
+// pixel-major: as luzes de um pixel ficam contíguas. Como cena e câmera são
+// estáticas, é calculado uma vez por versão do G-buffer/das luzes e substitui
+// as chamadas a Light no RIS, nos combines, na reconstrução e no sombreamento.
+// Só é usado quando pixels x luzes x 16 bytes cabe no orçamento configurado.
+class LightContributionCache {
+public:
+    vector<LightCacheEntry> entries;
+    int lightCount;
+    bool enabled;
+    unsigned int gBufferStamp;  // Construção do G-buffer a que corresponde
+    unsigned int lightsVersion;
+    int budgetMB;
+    
+    LightContributionCache() : lightCount(0), enabled(false), gBufferStamp(0), lightsVersion(0), budgetMB(-1) {}
+    
+    static double requiredMB(size_t pixels, size_t lights) {
+        return static_cast<double>(pixels) * lights * sizeof(LightCacheEntry) / (1024.0 * 1024.0);
+    }
+    
+    void build(const vector<Light>& lights, const vector<SurfacePoint>& points) {
+        lightCount = static_cast<int>(lights.size());
+        entries.resize(points.size() * lights.size());
+        int pixelCount = static_cast<int>(points.size());
+#pragma omp parallel for schedule(static)
+        for (int p = 0; p < pixelCount; p++) {
+            const SurfacePoint& point = points[p];
+            LightCacheEntry* row = &entries[static_cast<size_t>(p) * lightCount];
+            for (int l = 0; l < lightCount; l++) {
+                row[l].targetPdf = lights[l].calculateWeight(point.position, point.normal, point.albedo);
+                Color lighting = lights[l].calculateLighting(point.position, point.normal, point.albedo);
+                row[l].r = lighting.r;
+                row[l].g = lighting.g;
+                row[l].b = lighting.b;
+            }
+        }
+        enabled = true;
+    }
+    
+    void disable() {
+        enabled = false;
+        vector<LightCacheEntry>().swap(entries);
+    }
+    
+    const LightCacheEntry* lookup(int pixelIndex) const {
+        return enabled ? &entries[static_cast<size_t>(pixelIndex) * lightCount] : 0;
+    }
+};
+
+// Identificadores dos passos, usados para separar os fluxos aleatórios
+enum RenderPass {
+    PASS_INITIAL_RIS = 1,
+    PASS_SPATIAL = 2,
+    PASS_MONTE_CARLO = 3,
+    PASS_BASELINE_RIS = 4,
+    PASS_SPATIAL_EXTRA = 16 // Passes espaciais seguintes: PASS_SPATIAL_EXTRA + (passe - 1)
+};
+
+unsigned int spatialPassId(int pass) {
+    return pass == 0 ? PASS_SPATIAL : PASS_SPATIAL_EXTRA + pass - 1;
+}
+
+// Seleção dos vizinhos espaciais: disco de raio SPATIAL_RADIUS em torno do
+// pixel, ou o mesmo disco restrito ao bloco TILE_SIZE do pixel mais um halo
+// (leituras concentradas em ~(TILE_SIZE + 2 * halo)^2 reservatórios). A
+// restrição é por rejeição, com até SPATIAL_TILE_ATTEMPTS sorteios: prender o
+// deslocamento na borda acumularia vizinhos nela e distorceria a distribuição.
+enum SpatialNeighborMode {
+    SPATIAL_NEIGHBORS_DISC = 0,
+    SPATIAL_NEIGHBORS_TILE = 1
+};
+
+const int SPATIAL_TILE_HALO = 8;
+const int SPATIAL_TILE_ATTEMPTS = 8;
+
+// Parâmetros de uma renderização. O construtor copia as variáveis globais da
+// linha de comando; quem renderiza várias configurações no mesmo processo
+// (--sweep, benchmark de convergência) monta um RenderConfig por renderização.
+struct RenderConfig {
+    int maxCandidates;
+    bool spatialReuse;
+    int spatialPasses;
+    int spatialNeighbors;
+    int spatialRadius;
+    int spatialNeighborMode;
+    bool temporalReuse;
+    bool useBaselineImage;
+    bool unbiased;
+    bool monteCarlo;
+    int baselineRisSamples;
+    bool shadowRays;
+    bool visibilityReuse;
+    bool fusedPipeline;
+    
+    RenderConfig() : maxCandidates(MAX_CANDIDATES), spatialReuse(ENABLE_SPATIAL_REUSE), spatialPasses(SPATIAL_PASSES),
+                     spatialNeighbors(SPATIAL_NEIGHBORS), spatialRadius(SPATIAL_RADIUS),
+                     spatialNeighborMode(SPATIAL_NEIGHBOR_MODE), temporalReuse(ENABLE_TEMPORAL_REUSE),
+                     useBaselineImage(USE_BASELINE_IMAGE), unbiased(USE_UNBIASED_MODE),
+                     monteCarlo(USE_MONTE_CARLO_ONLY), baselineRisSamples(BASELINE_RIS_SAMPLES),
+                     shadowRays(SHADOW_RAYS || VISIBILITY_REUSE), visibilityReuse(VISIBILITY_REUSE),
+                     fusedPipeline(FUSED_PIPELINE) {}
+};
+
+// Renderizador ReSTIR CORRIGIDO
+class ReSTIRRenderer {
+public:
+    Scene scene;
+    ReservoirBuffer previousFrame;
+    vector<SurfacePoint> surfacePoints;
+    vector<Color> baselineImage; // Baseline carregada de arquivo (-b)
+    bool hasBaselineImage;
+    RenderConfig config; // Configuração da renderização em curso
+    
+    // Baseline RIS interna (-v) e a chave com que foi gerada: tarefas seguidas
+    // do --sweep com as mesmas amostras, cena e quadro reaproveitam a imagem
+    vector<Color> risBaselineImage;
+    int risBaselineSamples;
+    unsigned int risBaselineFrame;
+    unsigned int risBaselineGBufferStamp;
+    unsigned int risBaselineLightsVersion;
+    unsigned int risBaselineSeed;
+    unsigned int frameIndex;
+    LightBatchKernel lightBatchKernel;
+    
+    // Estado da cena/câmera com que o G-buffer (surfacePoints) foi construído
+    bool gBufferValid;
+    unsigned int gBufferGeometryVersion;
+    Vec3 gBufferCameraPos;
+    Vec3 gBufferCameraTarget;
+    unsigned int gBufferStamp; // Incrementado a cada construção do G-buffer
+    LightContributionCache lightCache;
+    
+    BackgroundImageWriter imageWriter;
+    
+    // Buffers por quadro, persistentes entre chamadas de render(): só são
+    // realocados quando a resolução ou o formato dos reservatórios muda
+    ReservoirBuffer currentFrame;   // RIS inicial + temporal (+ visibilidade)
+    ReservoirBuffer spatialScratch; // Segundo buffer do ping-pong da reutilização espacial
+    ReservoirBuffer nextHistory;    // Pipeline fundido: história do quadro em curso (troca com previousFrame)
+    vector<ReservoirBuffer> fusedStageFrames; // Pipeline fundido: saídas dos passes espaciais intermediários
+    
+    // Câmera ortográfica derivada de scene.cameraPos/cameraTarget na construção do G-buffer
+    OrthoCamera camera;
+    
+    // Reprojeção temporal (modo sequência): com trackMotion, cada reconstrução do
+    // G-buffer guarda o anterior e calcula, por pixel, de qual pixel do quadro
+    // anterior vem a história (-1 = desoclusão). Vazio = mesmo pixel.
+    bool trackMotion;
+    vector<SurfacePoint> previousSurfacePoints;
+    OrthoCamera previousCamera;
+    vector<Vec3> gBufferSphereCenters;
+    vector<int> reprojection;
+    
+    // Capacidade do buffer na pilha usado pela reutilização espacial unbiased
+    static const int MAX_REUSE_INPUTS = 32;
+    
+public:
+    // Sem a cena padrão (defaultScene = false) o chamador carrega a cena em
+    // "scene" antes de renderizar; assim nenhuma BVH é construída e descartada
+    explicit ReSTIRRenderer(bool defaultScene = true)
+        : hasBaselineImage(false), risBaselineSamples(0), risBaselineFrame(0), risBaselineGBufferStamp(0),
+          risBaselineLightsVersion(0), risBaselineSeed(0), frameIndex(0), lightBatchKernel(getLightBatchKernel()),
+          gBufferValid(false), gBufferGeometryVersion(0), gBufferStamp(0), trackMotion(false) {
+        if (defaultScene) {
+            scene.setupLights();
+            scene.setupSpheres();
+        }
+        // previousFrame e surfacePoints são alocados no primeiro uso: o modo em
+        // faixas nunca cria buffers do tamanho do quadro
+#ifdef _OPENMP
+        if (NUM_THREADS > 0) omp_set_num_threads(NUM_THREADS);
+#endif
+    }
+    
+    // Divisão da imagem (ou das linhas [rowBegin, rowEnd)) em blocos TILE_SIZE x TILE_SIZE
+    int tileCount(int rowBegin = 0, int rowEnd = -1) const {
+        if (rowEnd < 0) rowEnd = HEIGHT;
+        int tilesX = (WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+        int tilesY = (rowEnd - rowBegin + TILE_SIZE - 1) / TILE_SIZE;
+        return tilesX * tilesY;
+    }
+    
+    void tileBounds(int tile, int& x0, int& y0, int& x1, int& y1, int rowBegin = 0, int rowEnd = -1) const {
+        if (rowEnd < 0) rowEnd = HEIGHT;
+        int tilesX = (WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+        x0 = (tile % tilesX) * TILE_SIZE;
+        y0 = rowBegin + (tile / tilesX) * TILE_SIZE;
+        x1 = min(x0 + TILE_SIZE, WIDTH);
+        y1 = min(y0 + TILE_SIZE, rowEnd);
+    }
+    
+    // G-buffer persistente: a cena e a câmera são estáticas, então os pontos de
+    // superfície só são recalculados quando a geometria ou a câmera mudam.
+    // Compartilhado por render(), renderMonteCarlo(), renderRISBaseline() e iterações.
+    bool isGBufferCurrent() const {
+        return gBufferValid && gBufferGeometryVersion == scene.geometryVersion &&
+               gBufferCameraPos.x == scene.cameraPos.x && gBufferCameraPos.y == scene.cameraPos.y &&
+               gBufferCameraPos.z == scene.cameraPos.z && gBufferCameraTarget.x == scene.cameraTarget.x &&
+               gBufferCameraTarget.y == scene.cameraTarget.y && gBufferCameraTarget.z == scene.cameraTarget.z;
+    }
+    
+    void ensureGBuffer() {
+        METRIC_PHASE(PHASE_GBUFFER);
+        if (isGBufferCurrent()) {
+            // Nada se moveu desde o último quadro: a história é o mesmo pixel
+            if (trackMotion) reprojection.clear();
+            ensureLightCache();
+            return;
+        }
+        
+        bool reproject = trackMotion && gBufferValid && surfacePoints.size() == static_cast<size_t>(WIDTH * HEIGHT);
+        if (reproject) {
+            previousSurfacePoints.swap(surfacePoints);
+            previousCamera = camera;
+        }
+        camera = OrthoCamera(scene.cameraPos, scene.cameraTarget);
+        surfacePoints.resize(WIDTH * HEIGHT);
+        int totalTiles = tileCount();
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int tile = 0; tile < totalTiles; tile++) {
+            int x0, y0, x1, y1;
+            tileBounds(tile, x0, y0, x1, y1);
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    surfacePoints[y * WIDTH + x] = createSurfacePoint(static_cast<float>(x), static_cast<float>(y));
+                }
+            }
+        }
+        
+        gBufferValid = true;
+        gBufferGeometryVersion = scene.geometryVersion;
+        gBufferCameraPos = scene.cameraPos;
+        gBufferCameraTarget = scene.cameraTarget;
+        gBufferStamp++;
+        if (reproject) {
+            computeReprojection();
+        } else {
+            reprojection.clear();
+        }
+        if (trackMotion) {
+            gBufferSphereCenters.resize(scene.spheres.size());
+            for (size_t i = 0; i < scene.spheres.size(); i++) gBufferSphereCenters[i] = scene.spheres[i].center;
+        }
+        cout << "G-buffer construído (versão da geometria " << gBufferGeometryVersion << ")" << endl;
+        ensureLightCache();
+    }
+    
+    // Pixel do quadro anterior que serve de história temporal (-1 = rejeitado)
+    int historyPixel(int pixelIndex) const {
+        return reprojection.empty() ? pixelIndex : reprojection[pixelIndex];
+    }
+    
+    // Vetores de movimento a partir dos dois G-buffers: o ponto visível no pixel
+    // é levado de volta à sua posição no quadro anterior (esferas transladam
+    // junto com o centro, o plano é estático) e projetado pela câmera anterior.
+    // A história é rejeitada (desoclusão) se cair fora da imagem ou se o pixel
+    // anterior mostrar outra superfície, outra posição ou outra normal.
+    void computeReprojection() {
+        static const float MAX_POSITION_ERROR = 1.5f;
+        static const float MIN_NORMAL_DOT = 0.9f;
+        
+        reprojection.resize(WIDTH * HEIGHT);
+        int totalTiles = tileCount();
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int tile = 0; tile < totalTiles; tile++) {
+            int x0, y0, x1, y1;
+            tileBounds(tile, x0, y0, x1, y1);
+            int rejected = 0;
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    int pixelIndex = y * WIDTH + x;
+                    const SurfacePoint& point = surfacePoints[pixelIndex];
+                    Vec3 previousPosition = point.position;
+                    if (point.sphereIndex >= 0 && point.sphereIndex < static_cast<int>(gBufferSphereCenters.size())) {
+                        previousPosition = previousPosition - (scene.spheres[point.sphereIndex].center - gBufferSphereCenters[point.sphereIndex]);
+                    }
+                    float px, py;
+                    previousCamera.project(previousPosition, px, py);
+                    int prevX = static_cast<int>(floor(px + 0.5f));
+                    int prevY = static_cast<int>(floor(py + 0.5f));
+                    int history = -1;
+                    if (prevX >= 0 && prevX < WIDTH && prevY >= 0 && prevY < HEIGHT) {
+                        const SurfacePoint& previous = previousSurfacePoints[prevY * WIDTH + prevX];
+                        if (previous.sphereIndex == point.sphereIndex &&
+                            (previous.position - previousPosition).length() <= MAX_POSITION_ERROR &&
+                            previous.normal.dot(point.normal) >= MIN_NORMAL_DOT) {
+                            history = prevY * WIDTH + prevX;
+                        }
+                    }
+                    if (history < 0) rejected++;
+                    reprojection[pixelIndex] = history;
+                }
+            }
+            METRIC_COUNT(COUNTER_TEMPORAL_REJECTED, rejected);
+        }
+    }
+    
+    // (Re)constrói o cache de luzes quando o G-buffer, as luzes ou o orçamento mudam
+    void ensureLightCache() {
+        if (lightCache.gBufferStamp == gBufferStamp && lightCache.lightsVersion == scene.lightsVersion &&
+            lightCache.budgetMB == LIGHT_CACHE_BUDGET_MB) {
+            return;
+        }
+        lightCache.gBufferStamp = gBufferStamp;
+        lightCache.lightsVersion = scene.lightsVersion;
+        lightCache.budgetMB = LIGHT_CACHE_BUDGET_MB;
+        double requiredMB = LightContributionCache::requiredMB(surfacePoints.size(), scene.lights.size());
+        // Formata num stream local para não deixar fixed/precisão presos no cout
+        ostringstream size;
+        size << fixed << setprecision(1) << requiredMB;
+        if (LIGHT_CACHE_BUDGET_MB > 0 && requiredMB <= LIGHT_CACHE_BUDGET_MB) {
+            lightCache.build(scene.lights, surfacePoints);
+            cout << "Cache de luzes construído (" << size.str() << " MB)" << endl;
+        } else {
+            lightCache.disable();
+            if (LIGHT_CACHE_BUDGET_MB > 0) {
+                cout << "Cache de luzes desativado: precisa de " << size.str()
+                     << " MB (orçamento " << LIGHT_CACHE_BUDGET_MB << " MB)" << endl;
+            }
+        }
+    }
+    
+    // Luzes avaliadas no pixel do G-buffer (pelo cache, quando ativo e em dia)
+    PixelLighting lightingAt(int pixelIndex) const {
+        bool current = lightCache.gBufferStamp == gBufferStamp && lightCache.lightsVersion == scene.lightsVersion;
+        return PixelLighting(scene.lights, surfacePoints[pixelIndex], current ? lightCache.lookup(pixelIndex) : 0);
+    }
+    
+    // Candidatos do RIS: sorteia "count" luzes da distribuição de origem da cena.
+    // No modo em lote, cada grupo de LIGHT_BATCH_SIZE é sorteado de uma vez,
+    // avaliado pelo kernel SoA e só então passa pela seleção do reservatório.
+    // Com o cache de luzes ativo o lote é preenchido por consulta, sem o kernel.
+    void drawCandidateBatch(const PixelLighting& lighting, int count, RandomStream& rng, CandidateBatch& batch) const {
+        const LightSampler& sampler = scene.lightSampler();
+        batch.count = count;
+        METRIC_COUNT(COUNTER_TARGET_PDF, count);
+        for (int i = 0; i < count; i++) {
+            batch.lightIndex[i] = sampler.sample(lighting.point, rng, batch.sourcePdf[i]);
+        }
+        if (!lighting.cached) {
+            lightBatchKernel(scene.lights, scene.lightSoA, lighting.point, batch);
+            return;
+        }
+        for (int i = 0; i < count; i++) {
+            if (batch.lightIndex[i] < 0) continue;
+            const LightCacheEntry& entry = lighting.cached[batch.lightIndex[i]];
+            batch.targetPdf[i] = entry.targetPdf;
+            batch.lightingR[i] = entry.r;
+            batch.lightingG[i] = entry.g;
+            batch.lightingB[i] = entry.b;
+        }
+    }
+    
+    void generateCandidates(Reservoir& reservoir, const PixelLighting& lighting, int count, RandomStream& rng) const {
+        METRIC_COUNT(COUNTER_CANDIDATES, count);
+        if (!USE_LIGHT_BATCH) {
+            for (int i = 0; i < count; i++) {
+                float sourcePdf;
+                int lightIndex = scene.lightSampler().sample(lighting.point, rng, sourcePdf);
+                reservoir.update(lighting, lightIndex, sourcePdf, rng);
+            }
+            return;
+        }
+        CandidateBatch batch;
+        for (int first = 0; first < count; first += LIGHT_BATCH_SIZE) {
+            drawCandidateBatch(lighting, min(LIGHT_BATCH_SIZE, count - first), rng, batch);
+            for (int i = 0; i < batch.count; i++) {
+                if (batch.lightIndex[i] < 0) continue;
+                reservoir.updateEvaluated(batch.lightIndex[i], batch.targetPdf[i], batch.sourcePdf[i], rng);
+            }
+        }
+    }
+    
+    // Com "shadows", cada candidato com contribuição traça seu raio de sombra
+    // (o custo do Monte Carlo cresce com o número de candidatos)
+    void generateCandidates(MonteCarloReservoir& reservoir, const PixelLighting& lighting, int count, RandomStream& rng,
+                            bool shadows = false) const {
+        METRIC_COUNT(COUNTER_CANDIDATES, count);
+        if (!USE_LIGHT_BATCH) {
+            for (int i = 0; i < count; i++) {
+                float sourcePdf;
+                int lightIndex = scene.lightSampler().sample(lighting.point, rng, sourcePdf);
+                if (shadows && lightIndex >= 0 && lightIndex < lighting.lightCount() &&
+                    lighting.targetPdf(lightIndex) > 0.0f && !isVisible(lighting.point, lightIndex)) {
+                    reservoir.updateEvaluated(lighting.targetPdf(lightIndex), sourcePdf, Color(0, 0, 0));
+                    continue;
+                }
+                reservoir.update(lighting, lightIndex, sourcePdf);
+            }
+            return;
+        }
+        CandidateBatch batch;
+        for (int first = 0; first < count; first += LIGHT_BATCH_SIZE) {
+            drawCandidateBatch(lighting, min(LIGHT_BATCH_SIZE, count - first), rng, batch);
+            for (int i = 0; i < batch.count; i++) {
+                if (batch.lightIndex[i] < 0) continue;
+                Color sampleColor(batch.lightingR[i], batch.lightingG[i], batch.lightingB[i]);
+                if (shadows && batch.targetPdf[i] > 0.0f && !isVisible(lighting.point, batch.lightIndex[i])) {
+                    sampleColor = Color(0, 0, 0);
+                }
+                reservoir.updateEvaluated(batch.targetPdf[i], batch.sourcePdf[i], sampleColor);
+            }
+        }
+    }
+    
+    // Raio de sombra do ponto até a luz: consulta de oclusão contra as esferas.
+    // A origem sai da superfície ao longo da normal para não se auto-interceptar.
+    bool isVisible(const SurfacePoint& point, int lightIndex) const {
+        static const float SHADOW_RAY_OFFSET = 1e-2f;
+        METRIC_COUNT(COUNTER_SHADOW_RAYS, 1);
+        Vec3 origin = point.position + point.normal * SHADOW_RAY_OFFSET;
+        Vec3 toLight = scene.lights[lightIndex].position - origin;
+        float distance = toLight.length();
+        if (distance < EPSILON) return true;
+        bool blocked = scene.occluded(origin, toLight * (1.0f / distance), distance);
+        if (blocked) {
+            METRIC_COUNT(COUNTER_SHADOW_OCCLUDED, 1);
+        }
+        return !blocked;
+    }
+    
+    // Reutilização de visibilidade (--visibility-reuse): antes da reutilização
+    // espacial, só a amostra que sobreviveu no reservatório é testada
+    void applyVisibilityReuse(Reservoir& reservoir, const SurfacePoint& point) const {
+        if (reservoir.contributes() && !isVisible(point, reservoir.lightIndex)) reservoir.markOccluded();
+    }
+    
+    // Cor final do reservatório; com config.shadowRays, um raio de sombra por pixel
+    Color shadeReservoir(const Reservoir& reservoir, const PixelLighting& lighting) const {
+        if (config.shadowRays && reservoir.contributes() && !isVisible(lighting.point, reservoir.lightIndex)) {
+            return Color(0, 0, 0);
+        }
+        return reservoir.getFinalColor(lighting);
     }
-};
-
-// Renderizador ReSTIR CORRIGIDO
-class ReSTIRRenderer {
-public:
-    Scene scene;
-    vector<Reservoir> previousFrame;
-    vector<SurfacePoint> surfacePoints;
-    vector<Color> baselineImage;
-    bool hasBaselineImage;
     
-public:
-    ReSTIRRenderer() : hasBaselineImage(false) {
-        scene.setupLights();
-        scene.setupSpheres();
-        srand(static_cast<unsigned int>(time(NULL)));
-        previousFrame.resize(WIDTH * HEIGHT);
-        surfacePoints.resize(WIDTH * HEIGHT);
+    // Progresso por blocos concluídos (seguro com várias threads)
+    void reportTileProgress(const char* label, int& tilesDone, int totalTiles) const {
+#pragma omp critical(tile_progress)
+        {
+            tilesDone++;
+            int step = max(1, totalTiles / 10);
+            if (tilesDone % step == 0 || tilesDone == totalTiles) {
+                cout << label << " - Bloco " << tilesDone << "/" << totalTiles
+                     << " (" << fixed << setprecision(1)
+                     << (static_cast<float>(tilesDone) / totalTiles * 100) << "%)" << endl;
+            }
+        }
     }
     
     bool loadBaselineImage(const string& filename) {
+        METRIC_PHASE(PHASE_IO);
         int imgWidth, imgHeight;
-        baselineImage = PPMLoader::loadPPM(filename, imgWidth, imgHeight);
-        if (baselineImage.empty()) {
+        // Decodifica (e reamostra, se preciso) direto em baselineImage
+        if (!PPMLoader::load(filename, WIDTH, HEIGHT, baselineImage, imgWidth, imgHeight)) {
             cout << "Aviso: Não foi possível carregar a imagem baseline. Continuando sem reutilização temporal baseada em imagem." << endl;
+            baselineImage.clear();
             hasBaselineImage = false;
             return false;
         }
         if (imgWidth != WIDTH || imgHeight != HEIGHT) {
             cout << "Aviso: Dimensões da imagem baseline (" << imgWidth << "x" << imgHeight
-                 << ") não coincidem com as dimensões do renderizador (" << WIDTH << "x" << HEIGHT << ")" << endl;
-            cout << "Redimensionando ou usando apenas a parte compatível..." << endl;
-            vector<Color> resizedImage(WIDTH * HEIGHT, Color(0, 0, 0));
-            int minWidth = min(imgWidth, WIDTH);
-            int minHeight = min(imgHeight, HEIGHT);
-            for (int y = 0; y < minHeight; y++) {
-                for (int x = 0; x < minWidth; x++) {
-                    resizedImage[y * WIDTH + x] = baselineImage[y * imgWidth + x];
-                }
-            }
-            baselineImage = resizedImage;
+                 << ") não coincidem com as dimensões do renderizador (" << WIDTH << "x" << HEIGHT
+                 << "); imagem reamostrada (bilinear)" << endl;
         }
         hasBaselineImage = true;
         cout << "Imagem baseline carregada com sucesso para reutilização temporal!" << endl;
@@ -436,58 +3112,86 @@ public:
     // NOVA FUNÇÃO: Renderiza baseline RIS puro (sem reutilização espacial/temporal)
     vector<Color> renderRISBaseline(int samples) {
         vector<Color> image(WIDTH * HEIGHT);
-        vector<SurfacePoint> baselineSurfacePoints(WIDTH * HEIGHT);
         
         cout << "Gerando baseline RIS puro com " << samples << " amostras..." << endl;
         cout << "  - Sem reutilização espacial" << endl;
         cout << "  - Sem reutilização temporal" << endl;
         cout << "  - Apenas RIS com " << samples << " candidatos por pixel" << endl;
         
-        clock_t start = clock();
+        double start = wallTime();
+        ensureGBuffer();
+        METRIC_PHASE(PHASE_BASELINE);
+        unsigned int frame = frameIndex++;
+        int totalTiles = tileCount();
+        int tilesDone = 0;
         
-        for (int y = 0; y < HEIGHT; y++) {
-            if (y % 50 == 0) {
-                cout << "Baseline RIS - Linha " << y << "/" << HEIGHT
-                     << " (" << fixed << setprecision(1)
-                     << (static_cast<float>(y) / HEIGHT * 100) << "%)" << endl;
-            }
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int tile = 0; tile < totalTiles; tile++) {
+            int x0, y0, x1, y1;
+            tileBounds(tile, x0, y0, x1, y1);
             
-            for (int x = 0; x < WIDTH; x++) {
-                int pixelIndex = y * WIDTH + x;
-                SurfacePoint point = createSurfacePoint(static_cast<float>(x), static_cast<float>(y));
-                baselineSurfacePoints[pixelIndex] = point;
-                
-                // RIS puro com número especificado de candidatos
-                Reservoir reservoir;
-                reservoir.pixelOrigin = pixelIndex;
-                
-                for (int i = 0; i < samples; i++) {
-                    int lightIndex = randomInt(static_cast<int>(scene.lights.size()));
-                    reservoir.update(scene.lights, point, lightIndex);
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    int pixelIndex = y * WIDTH + x;
+                    const SurfacePoint& point = surfacePoints[pixelIndex];
+                    
+                    // RIS puro com número especificado de candidatos
+                    Reservoir reservoir;
+                    reservoir.pixelOrigin = pixelIndex;
+                    RandomStream rng(RANDOM_SEED, frame, PASS_BASELINE_RIS, pixelIndex);
+                    PixelLighting lighting = lightingAt(pixelIndex);
+                    generateCandidates(reservoir, lighting, samples, rng);
+                    
+                    // Renderizar cor final
+                    Color finalColor = shadeReservoir(reservoir, lighting);
+                    Color ambient = point.albedo * 0.005f;
+                    finalColor += ambient;
+                    image[pixelIndex] = finalColor;
                 }
-                
-                // Renderizar cor final
-                Color finalColor = reservoir.getFinalColor(scene.lights, point);
-                Color ambient = point.albedo * 0.005f;
-                finalColor += ambient;
-                image[pixelIndex] = finalColor;
             }
+            reportTileProgress("Baseline RIS", tilesDone, totalTiles);
         }
         
-        clock_t end = clock();
-        double duration = static_cast<double>(end - start) / CLOCKS_PER_SEC;
+        double duration = wallTime() - start;
         cout << "Baseline RIS gerado em " << duration << " segundos" << endl;
         
         return image;
     }
     
-    Reservoir reconstructReservoirFromBaseline(const Color& baselineColor, const SurfacePoint& point, int pixelIndex) {
+    // Gera a baseline RIS no quadro atual, ou reaproveita a anterior se foi
+    // gerada com as mesmas amostras, G-buffer, luzes, semente e quadro (o
+    // contador de quadros avança do mesmo jeito nos dois casos)
+    void ensureRISBaseline(int samples) {
+        ensureGBuffer();
+        if (!risBaselineImage.empty() && risBaselineSamples == samples && risBaselineFrame == frameIndex &&
+            risBaselineGBufferStamp == gBufferStamp && risBaselineLightsVersion == scene.lightsVersion &&
+            risBaselineSeed == RANDOM_SEED) {
+            cout << "Baseline RIS (" << samples << " amostras) reaproveitado" << endl;
+            frameIndex++;
+            return;
+        }
+        risBaselineFrame = frameIndex;
+        risBaselineImage = renderRISBaseline(samples);
+        risBaselineSamples = samples;
+        risBaselineGBufferStamp = gBufferStamp;
+        risBaselineLightsVersion = scene.lightsVersion;
+        risBaselineSeed = RANDOM_SEED;
+    }
+    
+    // Descarta a história temporal: a próxima renderização se comporta como a
+    // primeira de um processo novo, mas mantém G-buffer, cache de luzes e baselines
+    void resetHistory() {
+        previousFrame = ReservoirBuffer();
+        frameIndex = 0;
+    }
+    
+    Reservoir reconstructReservoirFromBaseline(const Color& baselineColor, const PixelLighting& lighting, int pixelIndex) {
         Reservoir reservoir;
         reservoir.pixelOrigin = pixelIndex;
         float bestMatch = -1.0f;
         int bestLightIndex = -1;
         for (int i = 0; i < static_cast<int>(scene.lights.size()); i++) {
-            Color lightContribution = scene.lights[i].calculateLighting(point.position, point.normal, point.albedo);
+            Color lightContribution = lighting.contribution(i);
             float similarity = 1.0f - fabs(baselineColor.r - lightContribution.r)
                                    - fabs(baselineColor.g - lightContribution.g)
                                    - fabs(baselineColor.b - lightContribution.b);
@@ -498,304 +3202,1917 @@ public:
         }
         if (bestLightIndex >= 0 && bestMatch > 0.0f) {
             reservoir.lightIndex = bestLightIndex;
-            reservoir.targetPdf = scene.lights[bestLightIndex].calculateWeight(point.position, point.normal, point.albedo);
+            reservoir.targetPdf = lighting.targetPdf(bestLightIndex);
             float intensity = baselineColor.luminance();
             reservoir.M = static_cast<int>(max(1.0f, intensity * 50.0f));
             reservoir.weight = reservoir.targetPdf * static_cast<float>(reservoir.M);
         }
-        return reservoir;
+        return reservoir;
+    }
+    
+    SurfacePoint createSurfacePoint(float x, float y) const {
+        Vec3 rayOrigin = camera.rayOrigin(x, y);
+        Vec3 rayDir = camera.forward;
+        
+        float closestDistance;
+        int closestSphere = scene.intersectSpheres(rayOrigin, rayDir, closestDistance);
+        
+        if (closestSphere >= 0) {
+            Vec3 hitPoint = rayOrigin + rayDir * closestDistance;
+            Vec3 normal = scene.spheres[closestSphere].getNormal(hitPoint);
+            Color albedo = scene.spheres[closestSphere].albedo;
+            
+            return SurfacePoint(hitPoint, normal, albedo, closestSphere);
+        }
+        
+        // Plano z = 0 (xadrez fixo no mundo, alinhado aos pixels na câmera padrão)
+        Vec3 position = rayOrigin + rayDir * (-rayOrigin.z / rayDir.z);
+        position.z = 0.0f;
+        Vec3 normal(0, 0, 1);
+        int checkerX = static_cast<int>(floor((position.x + WIDTH/2) / 50.0f));
+        int checkerY = static_cast<int>(floor((position.y + HEIGHT/2) / 50.0f));
+        int checker = (checkerX + checkerY) % 2;
+        Color albedo = checker ? Color(0.9f, 0.9f, 0.9f) : Color(0.1f, 0.1f, 0.1f);
+        return SurfacePoint(position, normal, albedo, -1);
+    }
+    
+    // Sorteia um vizinho de (x, y) conforme config.spatialNeighborMode; retorna se ele
+    // está dentro da imagem. O bloco do modo "tile" vem da grade global de
+    // blocos, então o vizinho não depende de quem percorre os pixels (faixas).
+    bool sampleSpatialNeighbor(int x, int y, RandomStream& rng, int& nx, int& ny) const {
+        int spatialRadius = config.spatialRadius;
+        if (config.spatialNeighborMode != SPATIAL_NEIGHBORS_TILE) {
+            sampleDiscOffset(x, y, spatialRadius, rng, nx, ny);
+            return nx >= 0 && nx < WIDTH && ny >= 0 && ny < HEIGHT;
+        }
+        // Redesenha até cair no bloco + halo; se nenhuma tentativa cair, não há vizinho
+        int halo = min(spatialRadius, SPATIAL_TILE_HALO);
+        int tileX = x - x % TILE_SIZE;
+        int tileY = y - y % TILE_SIZE;
+        for (int attempt = 0; attempt < SPATIAL_TILE_ATTEMPTS; attempt++) {
+            sampleDiscOffset(x, y, spatialRadius, rng, nx, ny);
+            if (nx >= tileX - halo && nx <= tileX + TILE_SIZE - 1 + halo &&
+                ny >= tileY - halo && ny <= tileY + TILE_SIZE - 1 + halo) {
+                return nx >= 0 && nx < WIDTH && ny >= 0 && ny < HEIGHT;
+            }
+        }
+        return false;
+    }
+    
+    static void sampleDiscOffset(int x, int y, int spatialRadius, RandomStream& rng, int& nx, int& ny) {
+        float angle = rng.nextFloat() * 2.0f * PI;
+        int dx = static_cast<int>(cos(angle) * (rng.nextFloat() * spatialRadius));
+        int dy = static_cast<int>(sin(angle) * (rng.nextFloat() * spatialRadius));
+        nx = x + dx;
+        ny = y + dy;
+    }
+    
+    // FUNÇÃO CORRIGIDA: Reutilização espacial com MIS correto.
+    // "reservoirs" começa na linha firstRow da imagem (0 = quadro inteiro; > 0 nas faixas)
+    void spatialReuseUnbiasedMISCorrected(Reservoir& reservoir, const PixelLighting& lighting, int x, int y,
+                                          const ReservoirBuffer& reservoirs, RandomStream& rng, int firstRow = 0) {
+        int spatialSamples = config.spatialNeighbors > 0 ? config.spatialNeighbors : 3; // Padrão reduzido no modo unbiased (mais caro)
+        int currentPixel = y * WIDTH + x;
+        
+        // Coleta reservatórios válidos num buffer fixo na pilha: os vizinhos são todos
+        // sorteados antes da combinação, preservando a ordem de consumo do rng
+        Reservoir inputReservoirs[MAX_REUSE_INPUTS];
+        int inputCount = 0;
+        
+        // Adiciona o próprio reservatório
+        inputReservoirs[inputCount++] = reservoir;
+        
+        // Adiciona vizinhos válidos
+        spatialSamples = min(spatialSamples, MAX_REUSE_INPUTS - 1);
+        for (int i = 0; i < spatialSamples; i++) {
+            int nx, ny;
+            if (sampleSpatialNeighbor(x, y, rng, nx, ny)) {
+                Reservoir neighbor = reservoirs.get((ny - firstRow) * WIDTH + nx);
+                if (neighbor.lightIndex >= 0 && neighbor.M > 0) {
+                    inputReservoirs[inputCount++] = neighbor;
+                }
+            } else {
+                METRIC_COUNT(COUNTER_NEIGHBOR_OUT_OF_BOUNDS, 1);
+            }
+        }
+        
+        // Combina usando MIS correto
+        UnbiasedMISCombiner combiner(currentPixel, lighting, rng);
+        for (int i = 0; i < inputCount; i++) combiner.add(inputReservoirs[i]);
+        reservoir = combiner.finish();
+    }
+    
+    void spatialReuse(Reservoir& reservoir, const PixelLighting& lighting, int x, int y, const ReservoirBuffer& reservoirs,
+                      RandomStream& rng, int firstRow = 0) {
+        if (config.unbiased) {
+            spatialReuseUnbiasedMISCorrected(reservoir, lighting, x, y, reservoirs, rng, firstRow);
+            return;
+        }
+        
+        // Modo biased original
+        int spatialSamples = config.spatialNeighbors > 0 ? config.spatialNeighbors : 4;
+        for (int i = 0; i < spatialSamples; i++) {
+            int nx, ny;
+            if (sampleSpatialNeighbor(x, y, rng, nx, ny)) {
+                Reservoir neighborReservoir = reservoirs.get((ny - firstRow) * WIDTH + nx);
+                reservoir.combine(neighborReservoir, lighting, rng, config.unbiased);
+            } else {
+                METRIC_COUNT(COUNTER_NEIGHBOR_OUT_OF_BOUNDS, 1);
+            }
+        }
+    }
+    
+    vector<Color> renderMonteCarlo() {
+        vector<Color> image;
+        renderMonteCarlo(image);
+        return image;
+    }
+    
+    void renderMonteCarlo(vector<Color>& image) {
+        image.resize(WIDTH * HEIGHT);
+        
+        cout << "Renderizando com MONTE CARLO PURO..." << endl;
+        cout << "Configuração:" << endl;
+        cout << "  MAX_CANDIDATES: " << config.maxCandidates << endl;
+        cout << "  MODO: Monte Carlo Puro (sem RIS, sem reutilização)" << endl;
+        cout << "  Total de luzes: " << scene.lights.size() << endl;
+        cout << "  Total de esferas: " << scene.spheres.size() << endl;
+        
+        double start = wallTime();
+        ensureGBuffer();
+        METRIC_FRAME();
+        // Candidatos e sombreamento do Monte Carlo contam como RIS inicial
+        METRIC_PHASE(PHASE_INITIAL_RIS);
+        unsigned int frame = frameIndex++;
+        int totalTiles = tileCount();
+        int tilesDone = 0;
+        
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int tile = 0; tile < totalTiles; tile++) {
+            int x0, y0, x1, y1;
+            tileBounds(tile, x0, y0, x1, y1);
+            
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    int pixelIndex = y * WIDTH + x;
+                    const SurfacePoint& point = surfacePoints[pixelIndex];
+                    
+                    MonteCarloReservoir mcReservoir;
+                    RandomStream rng(RANDOM_SEED, frame, PASS_MONTE_CARLO, pixelIndex);
+                    generateCandidates(mcReservoir, lightingAt(pixelIndex), config.maxCandidates, rng, config.shadowRays);
+                    
+                    Color finalColor = mcReservoir.getFinalColor();
+                    Color ambient = point.albedo * 0.005f;
+                    finalColor += ambient;
+                    image[pixelIndex] = finalColor;
+                }
+            }
+            reportTileProgress("Monte Carlo", tilesDone, totalTiles);
+        }
+        
+        double duration = wallTime() - start;
+        cout << "Renderização Monte Carlo concluída em " << duration << " segundos" << endl;
+    }
+    
+    // O formato compacto guarda o índice da luz em 16 bits
+    bool usePackedReservoirs() const {
+        if (!USE_PACKED_RESERVOIRS) return false;
+        if (scene.lights.size() >= PackedReservoir::MAX_LIGHTS) {
+            cout << "Aviso: " << scene.lights.size() << " luzes não cabem no reservatório compacto; usando formato float" << endl;
+            return false;
+        }
+        return true;
+    }
+    
+    vector<Color> render() {
+        return render(RenderConfig());
+    }
+    
+    // Etapas do quadro ReSTIR sobre o bloco [x0, x1) x [y0, y1), compartilhadas pelas
+    // varreduras do quadro inteiro e pelo pipeline fundido. Cada pixel usa os mesmos
+    // fluxos aleatórios e lê os mesmos dados nas duas ordens: a imagem é idêntica.
+    
+    // RIS inicial sobre o G-buffer persistente, reutilização temporal e, opcionalmente,
+    // de visibilidade. As etapas rodam uma após a outra no bloco (medidas
+    // separadamente); o fluxo aleatório de cada pixel continua de uma para a outra.
+    void initialReservoirsTile(int x0, int y0, int x1, int y1, unsigned int frame, const vector<Color>* baseline,
+                               ReservoirBuffer& output) {
+        Reservoir tileReservoirs[TILE_SIZE * TILE_SIZE];
+        RandomStream tileStreams[TILE_SIZE * TILE_SIZE];
+        
+        METRIC_CLOCK(risStart);
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                int pixelIndex = y * WIDTH + x;
+                int local = (y - y0) * TILE_SIZE + (x - x0);
+                tileReservoirs[local].pixelOrigin = pixelIndex;
+                tileStreams[local] = RandomStream(RANDOM_SEED, frame, PASS_INITIAL_RIS, pixelIndex);
+                generateCandidates(tileReservoirs[local], lightingAt(pixelIndex), config.maxCandidates, tileStreams[local]);
+            }
+        }
+        METRIC_SPLIT(PHASE_INITIAL_RIS, risStart);
+        
+        METRIC_CLOCK(temporalStart);
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                int pixelIndex = y * WIDTH + x;
+                int local = (y - y0) * TILE_SIZE + (x - x0);
+                Reservoir reservoir = tileReservoirs[local];
+                RandomStream& rng = tileStreams[local];
+                
+                // Reutilização temporal
+                if (config.temporalReuse) {
+                    PixelLighting lighting = lightingAt(pixelIndex);
+                    if (baseline && pixelIndex >= 0 && pixelIndex < static_cast<int>(baseline->size())) {
+                        Color baselineColor = (*baseline)[pixelIndex];
+                        Reservoir baselineReservoir = reconstructReservoirFromBaseline(baselineColor, lighting, pixelIndex);
+                        
+                        if (config.unbiased) {
+                            // Usar combinação corrigida para temporal também
+                            UnbiasedMISCombiner combiner(pixelIndex, lighting, rng);
+                            combiner.add(reservoir);
+                            combiner.add(baselineReservoir);
+                            reservoir = combiner.finish();
+                        } else {
+                            reservoir.combine(baselineReservoir, lighting, rng, config.unbiased);
+                        }
+                    } else {
+                        int history = historyPixel(pixelIndex);
+                        if (history >= 0 && history < static_cast<int>(previousFrame.size())) {
+                            // Limitação temporal conforme artigo (M anterior <= 20 * M atual)
+                            Reservoir tempReservoir = previousFrame.get(history);
+                            if (tempReservoir.M > 20 * reservoir.M) {
+                                tempReservoir.M = 20 * reservoir.M;
+                                tempReservoir.weight = tempReservoir.targetPdf * static_cast<float>(tempReservoir.M);
+                            }
+                        
+                            if (config.unbiased) {
+                                UnbiasedMISCombiner combiner(pixelIndex, lighting, rng);
+                                combiner.add(reservoir);
+                                combiner.add(tempReservoir);
+                                reservoir = combiner.finish();
+                            } else {
+                                reservoir.combine(tempReservoir, lighting, rng, config.unbiased);
+                            }
+                        }
+                    }
+                }
+                tileReservoirs[local] = reservoir;
+                output.set(pixelIndex, reservoir);
+            }
+        }
+        METRIC_SPLIT(PHASE_TEMPORAL, temporalStart);
+        
+        if (config.visibilityReuse) {
+            METRIC_CLOCK(visibilityStart);
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    int pixelIndex = y * WIDTH + x;
+                    Reservoir& reservoir = tileReservoirs[(y - y0) * TILE_SIZE + (x - x0)];
+                    applyVisibilityReuse(reservoir, surfacePoints[pixelIndex]);
+                    output.set(pixelIndex, reservoir);
+                }
+            }
+            METRIC_SPLIT(PHASE_VISIBILITY, visibilityStart);
+        }
+    }
+    
+    // Um passe de reutilização espacial: vizinhos lidos de "input", resultado em "output"
+    void spatialReuseTile(int x0, int y0, int x1, int y1, unsigned int frame, int pass,
+                          const ReservoirBuffer& input, ReservoirBuffer& output) {
+        unsigned int passId = spatialPassId(pass);
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                int pixelIndex = y * WIDTH + x;
+                Reservoir reservoir = input.get(pixelIndex);
+                RandomStream rng(RANDOM_SEED, frame, passId, pixelIndex);
+                spatialReuse(reservoir, lightingAt(pixelIndex), x, y, input, rng);
+                output.set(pixelIndex, reservoir);
+            }
+        }
+    }
+    
+    // Geração da imagem final; com "history", guarda os reservatórios para o próximo quadro
+    void shadeTile(int x0, int y0, int x1, int y1, const ReservoirBuffer& reservoirs, ReservoirBuffer* history,
+                   vector<Color>& image) {
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                int pixelIndex = y * WIDTH + x;
+                const SurfacePoint& point = surfacePoints[pixelIndex];
+                Reservoir reservoir = reservoirs.get(pixelIndex);
+                if (history) history->set(pixelIndex, reservoir);
+                METRIC_RECORD_M(reservoir.M);
+                Color finalColor = shadeReservoir(reservoir, lightingAt(pixelIndex));
+                Color ambient = point.albedo * 0.005f;
+                finalColor += ambient;
+                image[pixelIndex] = finalColor;
+            }
+        }
+    }
+    
+    // Quadro em três varreduras do quadro inteiro (padrão): cada etapa termina em
+    // todos os blocos antes de a próxima começar
+    void renderFrameSweeps(unsigned int frame, const vector<Color>* baseline, vector<Color>& image) {
+        int totalTiles = tileCount();
+        int tilesDone = 0;
+        
+        // Passo 1: RIS inicial, temporal e visibilidade
+        METRIC_CLOCK(firstPassStart);
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int tile = 0; tile < totalTiles; tile++) {
+            int x0, y0, x1, y1;
+            tileBounds(tile, x0, y0, x1, y1);
+            initialReservoirsTile(x0, y0, x1, y1, frame, baseline, currentFrame);
+            reportTileProgress("ReSTIR", tilesDone, totalTiles);
+        }
+        // Fim implícito do "parallel for": barreira antes do passo 2, que lê vizinhos de currentFrame
+        METRIC_COMMIT_SPLITS(firstPassStart);
+        
+        // Passo 2: Reutilização espacial em config.spatialPasses passes. Cada passe lê
+        // currentFrame e escreve em spatialScratch; a troca (swap) entre eles
+        // substitui as cópias do quadro
+        if (config.spatialReuse) {
+            METRIC_PHASE(PHASE_SPATIAL);
+            spatialScratch.ensure(currentFrame.size(), currentFrame.packed);
+            for (int pass = 0; pass < config.spatialPasses; pass++) {
+#pragma omp parallel for schedule(dynamic, 1)
+                for (int tile = 0; tile < totalTiles; tile++) {
+                    int x0, y0, x1, y1;
+                    tileBounds(tile, x0, y0, x1, y1);
+                    spatialReuseTile(x0, y0, x1, y1, frame, pass, currentFrame, spatialScratch);
+                }
+                currentFrame.swap(spatialScratch);
+            }
+        }
+        
+        // Passo 3: Geração da imagem final. A história do próximo quadro é o próprio
+        // currentFrame: a troca com previousFrame dispensa a cópia dos reservatórios
+        METRIC_CLOCK(shadingStart);
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int tile = 0; tile < totalTiles; tile++) {
+            int x0, y0, x1, y1;
+            tileBounds(tile, x0, y0, x1, y1);
+            shadeTile(x0, y0, x1, y1, currentFrame, 0, image);
+        }
+        previousFrame.swap(currentFrame);
+        METRIC_END_PHASE(PHASE_SHADING, shadingStart);
+    }
+    
+    // Defasagem, em faixas de blocos, entre etapas seguidas do pipeline fundido: o
+    // alcance vertical dos vizinhos espaciais mais uma faixa, para que etapas
+    // processadas no mesmo passo nunca leiam a faixa que a outra está escrevendo
+    int fusedBandLag() const {
+        int reach = config.spatialRadius;
+        if (config.spatialNeighborMode == SPATIAL_NEIGHBORS_TILE) reach = min(reach, SPATIAL_TILE_HALO);
+        return (reach + TILE_SIZE - 1) / TILE_SIZE + 1;
+    }
+    
+    // Pipeline fundido: as etapas avançam juntas, em frente de onda, sobre as faixas
+    // de blocos. No passo t, a etapa s (0 = RIS/temporal/visibilidade, 1..P = passes
+    // espaciais) processa a faixa t - s * fusedBandLag(), e o último passe sombreia
+    // o bloco logo em seguida. Entre a escrita de um reservatório e suas leituras
+    // passam poucas faixas, que continuam na cache em vez de voltarem da DRAM; o
+    // halo dos vizinhos é garantido pela ordem, sem recalcular pixels. A história
+    // vai para nextHistory, pois a temporal ainda lê previousFrame (com reprojeção,
+    // em qualquer faixa), e troca de lugar com ela no fim do quadro.
+    void renderFusedTiles(unsigned int frame, const vector<Color>* baseline, vector<Color>& image) {
+        int stages = config.spatialReuse ? config.spatialPasses : 0; // Passes espaciais
+        int lag = stages > 0 ? fusedBandLag() : 0;
+        int tilesX = (WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+        int bands = (HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+        int totalTiles = tileCount();
+        int tilesDone = 0;
+        
+        nextHistory.ensure(currentFrame.size(), currentFrame.packed);
+        // Saídas dos passes espaciais intermediários (o último escreve direto em nextHistory)
+        fusedStageFrames.resize(max(0, stages - 1));
+        for (size_t i = 0; i < fusedStageFrames.size(); i++) {
+            fusedStageFrames[i].ensure(currentFrame.size(), currentFrame.packed);
+        }
+        
+        METRIC_CLOCK(fusedStart);
+        int steps = bands + stages * lag;
+        for (int step = 0; step < steps; step++) {
+            // Fim implícito do "parallel for": barreira entre passos da frente de onda
+#pragma omp parallel for schedule(dynamic, 1)
+            for (int task = 0; task < (stages + 1) * tilesX; task++) {
+                int stage = task / tilesX;
+                int band = step - stage * lag;
+                if (band < 0 || band >= bands) continue;
+                int x0, y0, x1, y1;
+                tileBounds(band * tilesX + task % tilesX, x0, y0, x1, y1);
+                
+                if (stage == 0) {
+                    initialReservoirsTile(x0, y0, x1, y1, frame, baseline, currentFrame);
+                } else {
+                    const ReservoirBuffer& input = stage == 1 ? currentFrame : fusedStageFrames[stage - 2];
+                    ReservoirBuffer& output = stage == stages ? nextHistory : fusedStageFrames[stage - 1];
+                    METRIC_CLOCK(spatialStart);
+                    spatialReuseTile(x0, y0, x1, y1, frame, stage - 1, input, output);
+                    METRIC_SPLIT(PHASE_SPATIAL, spatialStart);
+                }
+                if (stage == stages) {
+                    METRIC_CLOCK(shadingStart);
+                    if (stages == 0) shadeTile(x0, y0, x1, y1, currentFrame, &nextHistory, image);
+                    else shadeTile(x0, y0, x1, y1, nextHistory, 0, image);
+                    METRIC_SPLIT(PHASE_SHADING, shadingStart);
+                    reportTileProgress("ReSTIR", tilesDone, totalTiles);
+                }
+            }
+        }
+        METRIC_COMMIT_SPLITS(fusedStart);
+        previousFrame.swap(nextHistory);
+    }
+    
+    vector<Color> render(const RenderConfig& renderConfig) {
+        vector<Color> image;
+        render(renderConfig, image);
+        return image;
+    }
+    
+    // Renderiza em "image", reaproveitando o buffer recebido: o laço de -i passa o
+    // que saveImage() devolve, então quadros seguidos não alocam nem copiam imagens
+    void render(const RenderConfig& renderConfig, vector<Color>& image) {
+        config = renderConfig;
+        if (config.monteCarlo) {
+            renderMonteCarlo(image);
+            return;
+        }
+        
+        image.resize(WIDTH * HEIGHT);
+        bool packedReservoirs = usePackedReservoirs();
+        currentFrame.ensure(WIDTH * HEIGHT, packedReservoirs);
+        if (previousFrame.size() != currentFrame.size()) previousFrame.resize(currentFrame.size(), packedReservoirs);
+        previousFrame.setPacked(packedReservoirs);
+        
+        // MODIFICAÇÃO: Verificar se deve gerar baseline RIS interno
+        const vector<Color>* baseline = (config.useBaselineImage && hasBaselineImage) ? &baselineImage : 0;
+        if (config.baselineRisSamples > 0) {
+            cout << "MODO BASELINE RIS INTERNO ATIVADO" << endl;
+            ensureRISBaseline(config.baselineRisSamples);
+            baseline = &risBaselineImage; // Forçar uso do baseline gerado
+        }
+        
+        cout << "Renderizando com ReSTIR " << (config.unbiased ? "UNBIASED CORRIGIDO" : "BIASED") << " + ESFERAS OTIMIZADAS..." << endl;
+        cout << "Configuração:" << endl;
+        cout << "  MAX_CANDIDATES: " << config.maxCandidates << endl;
+        cout << "  AMOSTRAGEM_ESPACIAL: " << (config.spatialReuse ? "ATIVADA" : "DESATIVADA") << endl;
+        cout << "  AMOSTRAGEM_TEMPORAL: " << (config.temporalReuse ? "ATIVADA" : "DESATIVADA") << endl;
+        
+        if (config.baselineRisSamples > 0) {
+            cout << "  BASELINE_RIS: ATIVADA (" << config.baselineRisSamples << " amostras)" << endl;
+        } else {
+            cout << "  BASELINE_IMAGE: " << (baseline ? "ATIVADA" : "DESATIVADA") << endl;
+        }
+        
+        cout << "  MODO: " << (config.unbiased ? "UNBIASED CORRIGIDO - SEM ESCURECIMENTO" : "BIASED") << endl;
+        cout << "  Total de luzes: " << scene.lights.size() << endl;
+        cout << "  Total de esferas: " << scene.spheres.size() << endl;
+        
+        double start = wallTime();
+        ensureGBuffer();
+        METRIC_FRAME();
+        unsigned int frame = frameIndex++;
+        if (config.fusedPipeline) renderFusedTiles(frame, baseline, image);
+        else renderFrameSweeps(frame, baseline, image);
+        
+        if (!CHECKPOINT_FILE.empty()) saveCheckpoint(CHECKPOINT_FILE);
+        
+        double duration = wallTime() - start;
+        cout << "Renderização concluída em " << duration << " segundos" << endl;
+    }
+    
+    // Entrega a imagem à thread de E/S, que a codifica no formato IMAGE_FORMAT e a
+    // grava enquanto o próximo quadro é renderizado (imageWriter.wait() sincroniza).
+    // "image" é trocada pelo buffer da gravação anterior: o conteúdo não é mantido.
+    void saveImage(vector<Color>& image, const string& filename) {
+        METRIC_PHASE(PHASE_IO);
+        imageWriter.submitImage(filename, image, static_cast<ImageFormat>(IMAGE_FORMAT), WIDTH, HEIGHT);
+        cout << "Gravando " << filename << " em segundo plano" << endl;
+    }
+    
+    // Grava previousFrame (o quadro recém-renderizado) pela thread de E/S
+    void saveCheckpoint(const string& filename) {
+        METRIC_PHASE(PHASE_IO);
+        ReservoirCheckpointHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "RSTRCKPT", 8);
+        header.version = ReservoirCheckpointHeader::VERSION;
+        header.byteOrder = ReservoirCheckpointHeader::BYTE_ORDER_MARK;
+        header.width = WIDTH;
+        header.height = HEIGHT;
+        header.seed = RANDOM_SEED;
+        header.frameIndex = frameIndex;
+        header.packed = previousFrame.packed ? 1 : 0;
+        header.recordSize = previousFrame.packed ? sizeof(PackedReservoir) : sizeof(ReservoirRecord);
+        header.sceneHash = scene.contentHash();
+        
+        size_t count = previousFrame.size();
+        vector<unsigned char> data(sizeof(header) + count * header.recordSize);
+        memcpy(&data[0], &header, sizeof(header));
+        if (previousFrame.packed) {
+            if (count > 0) memcpy(&data[sizeof(header)], &previousFrame.compact[0], count * sizeof(PackedReservoir));
+        } else {
+            ReservoirRecord* records = reinterpret_cast<ReservoirRecord*>(&data[sizeof(header)]);
+            for (size_t i = 0; i < count; i++) {
+                const Reservoir& r = previousFrame.full[i];
+                records[i].lightIndex = r.lightIndex;
+                records[i].M = r.M;
+                records[i].targetPdf = r.targetPdf;
+                records[i].weight = r.weight;
+            }
+        }
+        imageWriter.submit(filename, data, false);
+    }
+    
+    // Retoma previousFrame e frameIndex de um checkpoint compatível com a cena e
+    // a resolução atuais; custo O(1) por pixel, sem reconstrução a partir de cores
+    bool loadCheckpoint(const string& filename) {
+        METRIC_PHASE(PHASE_IO);
+        MappedFile file;
+        if (!file.open(filename)) {
+            cout << "Checkpoint " << filename << " não encontrado; começando sem histórico temporal" << endl;
+            return false;
+        }
+        ReservoirCheckpointHeader header;
+        if (file.size < sizeof(header)) {
+            cout << "Aviso: checkpoint " << filename << " inválido (truncado); ignorado" << endl;
+            return false;
+        }
+        memcpy(&header, file.data, sizeof(header));
+        const char* problem = 0;
+        if (memcmp(header.magic, "RSTRCKPT", 8) != 0 || header.byteOrder != ReservoirCheckpointHeader::BYTE_ORDER_MARK) {
+            problem = "formato desconhecido";
+        } else if (header.version != ReservoirCheckpointHeader::VERSION) {
+            problem = "versão incompatível";
+        } else if (header.width != static_cast<unsigned int>(WIDTH) || header.height != static_cast<unsigned int>(HEIGHT)) {
+            problem = "resolução diferente";
+        } else if (header.sceneHash != scene.contentHash()) {
+            problem = "cena diferente";
+        } else if (header.recordSize != (header.packed ? sizeof(PackedReservoir) : sizeof(ReservoirRecord)) ||
+                   file.size < sizeof(header) + static_cast<size_t>(WIDTH) * HEIGHT * header.recordSize) {
+            problem = "dados truncados";
+        }
+        if (problem) {
+            cout << "Aviso: checkpoint " << filename << " ignorado (" << problem << ")" << endl;
+            return false;
+        }
+        
+        int count = WIDTH * HEIGHT;
+        const unsigned char* records = file.data + sizeof(header);
+        
+        // Os registros também são conferidos antes de previousFrame ser tocado: um
+        // índice de luz fora da cena (arquivo corrompido ou editado) faria a
+        // combinação temporal ler fora de scene.lights
+        int lightCount = static_cast<int>(scene.lights.size());
+        int invalidRecords = 0;
+#pragma omp parallel for schedule(static) reduction(+:invalidRecords)
+        for (int i = 0; i < count; i++) {
+            const unsigned char* data = records + static_cast<size_t>(i) * header.recordSize;
+            Reservoir r;
+            if (header.packed) {
+                PackedReservoir packed;
+                memcpy(&packed, data, sizeof(packed));
+                r = packed.unpack(i);
+            } else {
+                ReservoirRecord record;
+                memcpy(&record, data, sizeof(record));
+                r.lightIndex = record.lightIndex;
+                r.M = record.M;
+            }
+            if (r.lightIndex >= lightCount || r.M < 0) invalidRecords++;
+        }
+        if (invalidRecords > 0) {
+            cout << "Aviso: checkpoint " << filename << " ignorado (" << invalidRecords << " registros inválidos)" << endl;
+            return false;
+        }
+        
+        previousFrame.resize(count, header.packed != 0);
+        if (header.packed) {
+            memcpy(&previousFrame.compact[0], records, count * sizeof(PackedReservoir));
+        } else {
+#pragma omp parallel for schedule(static)
+            for (int i = 0; i < count; i++) {
+                ReservoirRecord record;
+                memcpy(&record, records + static_cast<size_t>(i) * sizeof(ReservoirRecord), sizeof(record));
+                Reservoir& r = previousFrame.full[i];
+                r.lightIndex = record.lightIndex;
+                r.M = record.M;
+                r.targetPdf = record.targetPdf;
+                r.weight = record.weight;
+                r.pixelOrigin = i;
+            }
+        }
+        frameIndex = header.frameIndex;
+        cout << "Checkpoint carregado: " << filename << " (quadro " << header.frameIndex << ", "
+             << (header.packed ? "compacto" : "float") << ")" << endl;
+        if (header.seed != RANDOM_SEED) {
+            cout << "  Aviso: checkpoint gravado com semente " << header.seed << " (atual: " << RANDOM_SEED << ")" << endl;
+        }
+        return true;
+    }
+    
+    // Renderização fora do núcleo para quadros grandes (4K-16K): a imagem é
+    // processada em faixas de "bandRows" linhas. Cada faixa carrega um halo de
+    // raio espacial x passes linhas acima e abaixo (G-buffer + RIS inicial), e
+    // cada passe espacial encolhe esse halo em um raio, para
+    // que a reutilização espacial veja os mesmos vizinhos do quadro inteiro, e é
+    // gravada no arquivo assim que termina. A memória fica limitada pela faixa,
+    // não pelo quadro. Sem histórico do quadro inteiro não há reutilização
+    // temporal nem baseline; o resultado é igual ao de render() com --no-temporal-reuse.
+    bool renderOutOfCore(const string& filename, int bandRows) {
+        // Cabeçalho e faixas seguem pela thread de E/S, em ordem, enquanto a
+        // próxima faixa é renderizada. O PFM é gravado de baixo para cima.
+        ImageFormat format = static_cast<ImageFormat>(IMAGE_FORMAT);
+        bool bottomUp = (format == IMAGE_FORMAT_PFM);
+        string header = ImageEncoder::header(format, WIDTH, HEIGHT);
+        vector<unsigned char> encoded(header.begin(), header.end());
+        imageWriter.submit(filename, encoded, false);
+        if (!imageWriter.wait()) return false;
+        
+        config = RenderConfig();
+        camera = OrthoCamera(scene.cameraPos, scene.cameraTarget);
+        bool packedReservoirs = usePackedReservoirs();
+        int halo = config.spatialReuse ? config.spatialRadius * config.spatialPasses : 0;
+        int windowRows = min(HEIGHT, bandRows + 2 * halo);
+        ReservoirBuffer reservoirs, spatialReservoirs;
+        vector<SurfacePoint> points;
+        vector<Color> bandImage;
+        
+        size_t windowPixels = static_cast<size_t>(windowRows) * WIDTH;
+        double bandMB = (windowPixels * (sizeof(SurfacePoint) + (config.spatialReuse ? 2 : 1) *
+                         (packedReservoirs ? sizeof(PackedReservoir) : sizeof(Reservoir))) +
+                         static_cast<size_t>(bandRows) * WIDTH * sizeof(Color)) / (1024.0 * 1024.0);
+        double frameMB = static_cast<double>(WIDTH) * HEIGHT * (sizeof(SurfacePoint) + 3 * sizeof(Reservoir) + sizeof(Color)) /
+                         (1024.0 * 1024.0);
+        cout << "Renderizando " << WIDTH << "x" << HEIGHT << " fora do núcleo: faixas de " << bandRows
+             << " linhas + halo de " << halo << endl;
+        cout << "  Memória de trabalho: " << fixed << setprecision(1) << bandMB << " MB (quadro inteiro: ~"
+             << frameMB << " MB)" << endl;
+        if (config.temporalReuse || config.useBaselineImage) {
+            cout << "  Aviso: reutilização temporal/baseline ignoradas (sem histórico do quadro inteiro)" << endl;
+        }
+        
+        double start = wallTime();
+        METRIC_FRAME();
+        unsigned int frame = frameIndex++;
+        int bandsDone = 0;
+        int totalBands = (HEIGHT + bandRows - 1) / bandRows;
+        for (int band = 0; band < totalBands; band++) {
+            int bandBegin = (bottomUp ? totalBands - 1 - band : band) * bandRows;
+            int bandEnd = min(bandBegin + bandRows, HEIGHT);
+            int windowBegin = max(0, bandBegin - halo);
+            int windowEnd = min(HEIGHT, bandEnd + halo);
+            size_t pixels = static_cast<size_t>(windowEnd - windowBegin) * WIDTH;
+            points.resize(pixels);
+            reservoirs.resize(pixels, packedReservoirs);
+            bandImage.resize(static_cast<size_t>(bandEnd - bandBegin) * WIDTH);
+            
+            // G-buffer e RIS inicial da faixa com halo (um após o outro em cada bloco)
+            int windowTiles = tileCount(windowBegin, windowEnd);
+            METRIC_CLOCK(windowStart);
+#pragma omp parallel for schedule(dynamic, 1)
+            for (int tile = 0; tile < windowTiles; tile++) {
+                int x0, y0, x1, y1;
+                tileBounds(tile, x0, y0, x1, y1, windowBegin, windowEnd);
+                METRIC_CLOCK(gBufferStart);
+                for (int y = y0; y < y1; y++) {
+                    for (int x = x0; x < x1; x++) {
+                        points[(y - windowBegin) * WIDTH + x] = createSurfacePoint(static_cast<float>(x), static_cast<float>(y));
+                    }
+                }
+                METRIC_SPLIT(PHASE_GBUFFER, gBufferStart);
+                METRIC_CLOCK(risStart);
+                for (int y = y0; y < y1; y++) {
+                    for (int x = x0; x < x1; x++) {
+                        int pixelIndex = y * WIDTH + x;
+                        int local = (y - windowBegin) * WIDTH + x;
+                        Reservoir reservoir;
+                        reservoir.pixelOrigin = pixelIndex;
+                        RandomStream rng(RANDOM_SEED, frame, PASS_INITIAL_RIS, pixelIndex);
+                        generateCandidates(reservoir, PixelLighting(scene.lights, points[local]), config.maxCandidates, rng);
+                        if (config.visibilityReuse) applyVisibilityReuse(reservoir, points[local]);
+                        reservoirs.set(local, reservoir);
+                    }
+                }
+                METRIC_SPLIT(PHASE_INITIAL_RIS, risStart);
+            }
+            METRIC_COMMIT_SPLITS(windowStart);
+            
+            // Reutilização espacial e sombreamento só nas linhas da faixa
+            int bandTiles = tileCount(bandBegin, bandEnd);
+            if (config.spatialReuse) {
+                METRIC_PHASE(PHASE_SPATIAL);
+                if (spatialReservoirs.size() != pixels || spatialReservoirs.packed != packedReservoirs) {
+                    spatialReservoirs.resize(pixels, packedReservoirs);
+                }
+                for (int pass = 0; pass < config.spatialPasses; pass++) {
+                    // Linhas que os passes seguintes ainda vão ler
+                    int reach = (config.spatialPasses - 1 - pass) * config.spatialRadius;
+                    int passBegin = max(windowBegin, bandBegin - reach);
+                    int passEnd = min(windowEnd, bandEnd + reach);
+                    int passTiles = tileCount(passBegin, passEnd);
+                    unsigned int passId = spatialPassId(pass);
+#pragma omp parallel for schedule(dynamic, 1)
+                    for (int tile = 0; tile < passTiles; tile++) {
+                        int x0, y0, x1, y1;
+                        tileBounds(tile, x0, y0, x1, y1, passBegin, passEnd);
+                        for (int y = y0; y < y1; y++) {
+                            for (int x = x0; x < x1; x++) {
+                                int pixelIndex = y * WIDTH + x;
+                                int local = (y - windowBegin) * WIDTH + x;
+                                Reservoir reservoir = reservoirs.get(local);
+                                RandomStream rng(RANDOM_SEED, frame, passId, pixelIndex);
+                                spatialReuse(reservoir, PixelLighting(scene.lights, points[local]), x, y, reservoirs, rng, windowBegin);
+                                spatialReservoirs.set(local, reservoir);
+                            }
+                        }
+                    }
+                    reservoirs.swap(spatialReservoirs);
+                }
+            }
+            const ReservoirBuffer& finalReservoirs = reservoirs;
+            
+            METRIC_CLOCK(shadingStart);
+#pragma omp parallel for schedule(dynamic, 1)
+            for (int tile = 0; tile < bandTiles; tile++) {
+                int x0, y0, x1, y1;
+                tileBounds(tile, x0, y0, x1, y1, bandBegin, bandEnd);
+                for (int y = y0; y < y1; y++) {
+                    for (int x = x0; x < x1; x++) {
+                        int local = (y - windowBegin) * WIDTH + x;
+                        const SurfacePoint& point = points[local];
+                        Reservoir reservoir = finalReservoirs.get(local);
+                        METRIC_RECORD_M(reservoir.M);
+                        Color finalColor = shadeReservoir(reservoir, PixelLighting(scene.lights, point));
+                        finalColor += point.albedo * 0.005f;
+                        bandImage[(y - bandBegin) * WIDTH + x] = finalColor;
+                    }
+                }
+            }
+            METRIC_END_PHASE(PHASE_SHADING, shadingStart);
+            
+            METRIC_CLOCK(ioStart);
+            ImageEncoder::appendRows(format, &bandImage[0], WIDTH, bandEnd - bandBegin, encoded);
+            imageWriter.submit(filename, encoded, true);
+            METRIC_END_PHASE(PHASE_IO, ioStart);
+            bandsDone++;
+            if (bandsDone % max(1, totalBands / 10) == 0 || bandsDone == totalBands) {
+                cout << "Faixa " << bandsDone << "/" << totalBands << " gravada (linhas " << bandBegin
+                     << "-" << bandEnd - 1 << ")" << endl;
+            }
+        }
+        METRIC_CLOCK(waitStart);
+        bool written = imageWriter.wait();
+        METRIC_END_PHASE(PHASE_IO, waitStart);
+        
+        cout << "Renderização concluída em " << wallTime() - start << " segundos" << endl;
+        if (written) cout << "Imagem salva como " << filename << endl;
+        return written;
     }
+};
+
+// Benchmark: custo de interseção por pixel (BVH x força bruta) de 10^2 a 10^6 esferas
+void runBVHBenchmark() {
+    ReSTIRRenderer renderer;
+    Scene& scene = renderer.scene;
+    const int pixelCount = WIDTH * HEIGHT;
     
-    SurfacePoint createSurfacePoint(float x, float y) const {
-        Vec3 rayOrigin(x - WIDTH/2, y - HEIGHT/2, 100);
-        Vec3 rayDir(0, 0, -1);
+    cout << endl << "=== Benchmark BVH: interseção de raios primários ===" << endl;
+    cout << setw(10) << "esferas" << setw(12) << "build(ms)" << setw(14) << "BVH(ns/px)"
+         << setw(16) << "linear(ns/px)" << setw(12) << "speedup" << setw(12) << "erros" << endl;
+    
+    for (int n = 100; n <= 1000000; n *= 10) {
+        RandomStream rng(RANDOM_SEED, 0, 0, static_cast<unsigned int>(n));
+        float radius = 22.0f * sqrt(96.0f / static_cast<float>(n));
+        scene.spheres.clear();
+        for (int i = 0; i < n; i++) {
+            Vec3 center((rng.nextFloat() - 0.5f) * WIDTH, (rng.nextFloat() - 0.5f) * HEIGHT, rng.nextFloat() * 40.0f);
+            scene.spheres.push_back(Sphere(center, radius, Color(0.95f, 0.95f, 0.95f)));
+        }
         
-        float closestDistance = 1e30f;
-        int closestSphere = -1;
+        double t0 = wallTime();
+        scene.buildAccelerationStructure();
+        double buildTime = wallTime() - t0;
         
-        for (int i = 0; i < static_cast<int>(scene.spheres.size()); i++) {
-            float distance = scene.spheres[i].intersect(rayOrigin, rayDir);
-            if (distance > 0 && distance < closestDistance) {
-                closestDistance = distance;
-                closestSphere = i;
-            }
+        float checksum = 0.0f;
+        t0 = wallTime();
+        for (int p = 0; p < pixelCount; p++) {
+            SurfacePoint point = renderer.createSurfacePoint(static_cast<float>(p % WIDTH), static_cast<float>(p / WIDTH));
+            checksum += point.position.z;
         }
+        double bvhNs = (wallTime() - t0) * 1e9 / pixelCount;
         
-        if (closestSphere >= 0) {
-            Vec3 hitPoint = rayOrigin + rayDir * closestDistance;
-            Vec3 normal = scene.spheres[closestSphere].getNormal(hitPoint);
-            Color albedo = scene.spheres[closestSphere].albedo;
-            
-            return SurfacePoint(hitPoint, normal, albedo, true);
+        // Força bruta: amostra um subconjunto de pixels para manter o tempo limitado
+        int stride = max(1, n / 1000);
+        int mismatches = 0;
+        int tested = 0;
+        t0 = wallTime();
+        for (int p = 0; p < pixelCount; p += stride) {
+            Vec3 rayOrigin(static_cast<float>(p % WIDTH) - WIDTH/2, static_cast<float>(p / WIDTH) - HEIGHT/2, 100);
+            float distance;
+            int hit = scene.intersectSpheresLinear(rayOrigin, Vec3(0, 0, -1), distance);
+            checksum += distance;
+            tested++;
+            float bvhDistance;
+            if (scene.intersectSpheres(rayOrigin, Vec3(0, 0, -1), bvhDistance) != hit && fabs(bvhDistance - distance) > 1e-3f) {
+                mismatches++;
+            }
         }
+        double linearNs = (wallTime() - t0) * 1e9 / tested;
         
-        Vec3 position(x - WIDTH/2, y - HEIGHT/2, 0);
-        Vec3 normal(0, 0, 1);
-        int checkerX = static_cast<int>(floor(x / 50.0f));
-        int checkerY = static_cast<int>(floor(y / 50.0f));
-        int checker = (checkerX + checkerY) % 2;
-        Color albedo = checker ? Color(0.9f, 0.9f, 0.9f) : Color(0.1f, 0.1f, 0.1f);
-        return SurfacePoint(position, normal, albedo, false);
+        cout << setw(10) << n << setw(12) << fixed << setprecision(2) << buildTime * 1000.0
+             << setw(14) << setprecision(1) << bvhNs << setw(16) << linearNs
+             << setw(11) << setprecision(1) << linearNs / bvhNs << "x" << setw(12) << mismatches << endl;
+        if (checksum == 12345.0f) cout << endl; // evita que o compilador descarte os laços
     }
+    cout << "(força bruta inclui uma consulta extra à BVH para validação)" << endl;
+}
+
+// Benchmark: kernels de interseção escalar AoS x SoA escalar/SSE/AVX2
+void runKernelBenchmark() {
+    ReSTIRRenderer renderer;
+    Scene& scene = renderer.scene;
+    const int pixelCount = WIDTH * HEIGHT;
+    SphereKernelType kernels[3] = { SPHERE_KERNEL_SCALAR, SPHERE_KERNEL_SSE, SPHERE_KERNEL_AVX2 };
+    int kernelCount = (detectSphereKernel() == SPHERE_KERNEL_AVX2) ? 3 : (detectSphereKernel() == SPHERE_KERNEL_SSE ? 2 : 1);
     
-    // FUNÇÃO CORRIGIDA: Reutilização espacial com MIS correto
-    void spatialReuseUnbiasedMISCorrected(Reservoir& reservoir, int x, int y, const vector<Reservoir>& reservoirs) {
-        int spatialSamples = 3; // Reduzido para modo unbiased (mais caro)
-        int spatialRadius = 20;
-        int currentPixel = y * WIDTH + x;
+    // 1) Vazão bruta: cada raio contra todas as esferas, sem BVH
+    const int rayCount = 20000;
+    cout << endl << "=== Benchmark kernels: raio x todas as " << scene.spheres.size() << " esferas da cena (sem BVH) ===" << endl;
+    cout << setw(12) << "kernel" << setw(18) << "ns/teste" << setw(14) << "speedup" << endl;
+    float checksum = 0.0f;
+    double t0 = wallTime();
+    for (int r = 0; r < rayCount; r++) {
+        int p = (r * 7919) % pixelCount;
+        Vec3 rayOrigin(static_cast<float>(p % WIDTH) - WIDTH/2, static_cast<float>(p / WIDTH) - HEIGHT/2, 100);
+        float distance;
+        checksum += static_cast<float>(scene.intersectSpheresLinear(rayOrigin, Vec3(0, 0, -1), distance));
+    }
+    double tests = static_cast<double>(rayCount) * scene.spheres.size();
+    double aosNs = (wallTime() - t0) * 1e9 / tests;
+    cout << setw(12) << "AoS" << setw(18) << fixed << setprecision(3) << aosNs << setw(13) << setprecision(2) << 1.0 << "x" << endl;
+    for (int k = 0; k < kernelCount; k++) {
+        SphereLeafKernel kernel = getSphereKernel(kernels[k]);
+        t0 = wallTime();
+        for (int r = 0; r < rayCount; r++) {
+            int p = (r * 7919) % pixelCount;
+            Vec3 rayOrigin(static_cast<float>(p % WIDTH) - WIDTH/2, static_cast<float>(p / WIDTH) - HEIGHT/2, 100);
+            float distance = 1e30f;
+            checksum += static_cast<float>(kernel(scene.sphereBVH.soa, 0, static_cast<int>(scene.spheres.size()), rayOrigin, Vec3(0, 0, -1), distance));
+        }
+        double ns = (wallTime() - t0) * 1e9 / tests;
+        cout << setw(12) << sphereKernelName(kernels[k]) << setw(18) << setprecision(3) << ns
+             << setw(13) << setprecision(2) << aosNs / ns << "x" << endl;
+    }
+    
+    // 2) Quadro completo pela BVH (createSurfacePoint) com cada kernel nas folhas
+    cout << endl << "=== Benchmark kernels: quadro completo via BVH ===" << endl;
+    cout << setw(10) << "esferas" << setw(12) << "kernel" << setw(14) << "ns/pixel" << setw(14) << "speedup" << setw(12) << "erros" << endl;
+    for (int n = 100; n <= 100000; n *= 10) {
+        RandomStream rng(RANDOM_SEED, 0, 0, static_cast<unsigned int>(n));
+        float radius = 22.0f * sqrt(96.0f / static_cast<float>(n));
+        scene.spheres.clear();
+        for (int i = 0; i < n; i++) {
+            Vec3 center((rng.nextFloat() - 0.5f) * WIDTH, (rng.nextFloat() - 0.5f) * HEIGHT, rng.nextFloat() * 40.0f);
+            scene.spheres.push_back(Sphere(center, radius, Color(0.95f, 0.95f, 0.95f)));
+        }
+        scene.buildAccelerationStructure();
         
-        // Coleta reservatórios válidos
-        vector<Reservoir> inputReservoirs;
-        vector<int> pixelOrigins;
+        vector<float> reference(pixelCount);
+        double scalarNs = 0.0;
+        for (int k = 0; k < kernelCount; k++) {
+            scene.sphereBVH.leafKernel = getSphereKernel(kernels[k]);
+            int mismatches = 0;
+            t0 = wallTime();
+            for (int p = 0; p < pixelCount; p++) {
+                SurfacePoint point = renderer.createSurfacePoint(static_cast<float>(p % WIDTH), static_cast<float>(p / WIDTH));
+                if (k == 0) reference[p] = point.position.z;
+                else if (reference[p] != point.position.z) mismatches++;
+            }
+            double ns = (wallTime() - t0) * 1e9 / pixelCount;
+            if (k == 0) scalarNs = ns;
+            cout << setw(10) << n << setw(12) << sphereKernelName(kernels[k]) << setw(14) << setprecision(1) << ns
+                 << setw(13) << setprecision(2) << scalarNs / ns << "x" << setw(12) << mismatches << endl;
+        }
+    }
+    if (checksum == 12345.0f) cout << endl; // evita que o compilador descarte os laços
+}
+
+// Erro quadrático médio por canal entre duas imagens do mesmo tamanho
+double computeMSE(const vector<Color>& image, const vector<Color>& reference) {
+    double sum = 0.0;
+    for (size_t i = 0; i < image.size(); i++) {
+        double dr = image[i].r - reference[i].r;
+        double dg = image[i].g - reference[i].g;
+        double db = image[i].b - reference[i].b;
+        sum += dr * dr + dg * dg + db * db;
+    }
+    return image.empty() ? 0.0 : sum / (3.0 * image.size());
+}
+
+// Benchmark: RIS puro com candidatos uniformes x tabela de alias, em igualdade de tempo.
+// A referência é a soma exata da contribuição de todas as luzes (valor esperado do RIS).
+void runLightSamplingBenchmark() {
+    ReSTIRRenderer renderer;
+    Scene& scene = renderer.scene;
+    renderer.ensureGBuffer();
+    
+    vector<Color> reference(WIDTH * HEIGHT);
+    for (int p = 0; p < WIDTH * HEIGHT; p++) {
+        const SurfacePoint& point = renderer.surfacePoints[p];
+        Color sum = point.albedo * 0.005f;
+        for (size_t l = 0; l < scene.lights.size(); l++) {
+            sum += scene.lights[l].calculateLighting(point.position, point.normal, point.albedo);
+        }
+        reference[p] = sum;
+    }
+    
+    LightSamplingType types[2] = { LIGHT_SAMPLING_UNIFORM, LIGHT_SAMPLING_ALIAS };
+    int candidateCounts[6] = { 1, 2, 4, 8, 16, 32 };
+    double times[2][6], errors[2][6];
+    for (int c = 0; c < 6; c++) {
+        for (int t = 0; t < 2; t++) {
+            scene.lightSamplingType = types[t];
+            double t0 = wallTime();
+            vector<Color> image = renderer.renderRISBaseline(candidateCounts[c]);
+            times[t][c] = wallTime() - t0;
+            errors[t][c] = computeMSE(image, reference);
+        }
+    }
+    
+    cout << endl << "=== Benchmark amostragem de luzes (RIS puro, " << scene.lights.size() << " luzes) ===" << endl;
+    cout << setw(12) << "candidatos" << setw(12) << "amostragem" << setw(12) << "tempo(s)"
+         << setw(14) << "MSE" << setw(16) << "1/(MSE*tempo)" << endl;
+    for (int c = 0; c < 6; c++) {
+        for (int t = 0; t < 2; t++) {
+            scene.lightSamplingType = types[t];
+            cout << setw(12) << candidateCounts[c] << setw(12) << scene.lightSampler().name()
+                 << setw(12) << fixed << setprecision(3) << times[t][c]
+                 << setw(14) << scientific << setprecision(3) << errors[t][c]
+                 << setw(16) << 1.0 / (errors[t][c] * times[t][c]) << fixed << endl;
+        }
+    }
+    
+    // Igualdade de tempo: para cada orçamento uniforme, o melhor erro do alias que cabe nele
+    cout << endl << "Igualdade de tempo (alias com tempo <= uniforme):" << endl;
+    for (int c = 0; c < 6; c++) {
+        int best = -1;
+        for (int a = 0; a < 6; a++) {
+            if (times[1][a] <= times[0][c] && (best < 0 || errors[1][a] < errors[1][best])) best = a;
+        }
+        cout << "  uniforme c=" << candidateCounts[c] << " MSE " << scientific << setprecision(3) << errors[0][c];
+        if (best >= 0) cout << "  |  alias c=" << candidateCounts[best] << " MSE " << errors[1][best];
+        else cout << "  |  alias: nenhuma configuração no orçamento";
+        cout << fixed << endl;
+    }
+}
+
+// Benchmark: árvore de luzes x uniforme x alias com 10^2 a 10^5 luzes.
+// Usa um subconjunto de pixels para que a referência exata (soma de todas as luzes) seja viável.
+void runLightTreeBenchmark() {
+    ReSTIRRenderer renderer;
+    Scene& scene = renderer.scene;
+    renderer.ensureGBuffer();
+    const int pixelStride = 97;
+    const int candidates = 8;
+    LightSamplingType types[3] = { LIGHT_SAMPLING_UNIFORM, LIGHT_SAMPLING_ALIAS, LIGHT_SAMPLING_TREE };
+    
+    cout << endl << "=== Benchmark árvore de luzes (RIS puro, " << candidates << " candidatos, 1 a cada "
+         << pixelStride << " pixels) ===" << endl;
+    cout << setw(10) << "luzes" << setw(12) << "amostragem" << setw(12) << "build(ms)" << setw(12) << "ns/pixel"
+         << setw(14) << "relMSE" << setw(16) << "1/(relMSE*t)" << setw(12) << "soma pdf" << endl;
+    
+    for (int lightCount = 100; lightCount <= 100000; lightCount *= 10) {
+        double t0 = wallTime();
+        scene.setupRandomLights(lightCount, RANDOM_SEED);
+        double buildTime = wallTime() - t0;
         
-        // Adiciona o próprio reservatório
-        inputReservoirs.push_back(reservoir);
-        pixelOrigins.push_back(currentPixel);
+        vector<int> pixels;
+        for (int p = 0; p < WIDTH * HEIGHT; p += pixelStride) pixels.push_back(p);
+        vector<Color> reference(pixels.size());
+        for (size_t i = 0; i < pixels.size(); i++) {
+            const SurfacePoint& point = renderer.surfacePoints[pixels[i]];
+            Color sum;
+            for (int l = 0; l < lightCount; l++) {
+                sum += scene.lights[l].calculateLighting(point.position, point.normal, point.albedo);
+            }
+            reference[i] = sum;
+        }
         
-        // Adiciona vizinhos válidos
-        for (int i = 0; i < spatialSamples; i++) {
-            float angle = randomFloat() * 2.0f * PI;
-            int dx = static_cast<int>(cos(angle) * (randomFloat() * spatialRadius));
-            int dy = static_cast<int>(sin(angle) * (randomFloat() * spatialRadius));
-            int nx = x + dx;
-            int ny = y + dy;
-            if (nx >= 0 && nx < WIDTH && ny >= 0 && ny < HEIGHT) {
-                int neighborIdx = ny * WIDTH + nx;
-                const Reservoir& neighbor = reservoirs[neighborIdx];
-                if (neighbor.lightIndex >= 0 && neighbor.M > 0) {
-                    inputReservoirs.push_back(neighbor);
-                    pixelOrigins.push_back(neighborIdx);
+        for (int t = 0; t < 3; t++) {
+            scene.lightSamplingType = types[t];
+            const LightSampler& sampler = scene.lightSampler();
+            
+            // Sanidade: a pdf de todas as luzes deve somar 1 em um ponto qualquer
+            double pdfSum = 0.0;
+            const SurfacePoint& probe = renderer.surfacePoints[pixels[pixels.size() / 2]];
+            for (int l = 0; l < lightCount; l++) pdfSum += sampler.pdf(probe, l);
+            
+            vector<Color> estimate(pixels.size());
+            t0 = wallTime();
+            for (size_t i = 0; i < pixels.size(); i++) {
+                const SurfacePoint& point = renderer.surfacePoints[pixels[i]];
+                RandomStream rng(RANDOM_SEED, 0, PASS_BASELINE_RIS, pixels[i]);
+                Reservoir reservoir;
+                for (int c = 0; c < candidates; c++) {
+                    float sourcePdf;
+                    int lightIndex = sampler.sample(point, rng, sourcePdf);
+                    reservoir.update(PixelLighting(scene.lights, point), lightIndex, sourcePdf, rng);
                 }
+                estimate[i] = reservoir.getFinalColor(PixelLighting(scene.lights, point));
             }
+            double elapsed = wallTime() - t0;
+            
+            // relMSE: erro relativo à luminância da referência, estável entre cenas com brilhos diferentes
+            double relMSE = 0.0;
+            for (size_t i = 0; i < pixels.size(); i++) {
+                double diff = estimate[i].luminance() - reference[i].luminance();
+                double ref = reference[i].luminance();
+                relMSE += diff * diff / (ref * ref + 1e-4);
+            }
+            relMSE /= pixels.size();
+            
+            cout << setw(10) << lightCount << setw(12) << sampler.name()
+                 << setw(12) << fixed << setprecision(2) << (t == 0 ? buildTime * 1000.0 : 0.0)
+                 << setw(12) << setprecision(1) << elapsed * 1e9 / pixels.size()
+                 << setw(14) << scientific << setprecision(3) << relMSE
+                 << setw(16) << 1.0 / (relMSE * elapsed) << fixed
+                 << setw(12) << setprecision(4) << pdfSum << endl;
         }
-        
-        // Combina usando MIS correto
-        reservoir = combineReservoirsUnbiasedMISCorrected(currentPixel, inputReservoirs, pixelOrigins, surfacePoints, scene.lights);
     }
+    cout << "(build(ms) = construção de todas as estruturas de amostragem)" << endl;
+}
+
+// Benchmark: formato float (20 bytes) x compacto (8 bytes) dos quadros de reservatórios.
+// 1) Banda: um passo estilo reutilização espacial sobre um quadro 4K (3840x2160).
+// 2) Erro de imagem: mesma semente, 3 quadros com reutilização temporal/espacial.
+void runReservoirLayoutBenchmark() {
+    const int benchWidth = 3840;
+    const int benchHeight = 2160;
+    const int pixelCount = benchWidth * benchHeight;
+    const int offsetX[4] = { -13, 11, -6, 15 };
+    const int offsetY[4] = { -7, -5, 9, 12 };
     
-    void spatialReuse(Reservoir& reservoir, const SurfacePoint& point, int x, int y, const vector<Reservoir>& reservoirs) {
-        if (USE_UNBIASED_MODE) {
-            spatialReuseUnbiasedMISCorrected(reservoir, x, y, reservoirs);
-            return;
+    cout << endl << "=== Benchmark layout de reservatórios: banda em " << benchWidth << "x" << benchHeight << " ===" << endl;
+    cout << setw(10) << "formato" << setw(14) << "bytes/pixel" << setw(14) << "quadro(MB)"
+         << setw(12) << "ns/pixel" << setw(12) << "GB/s" << endl;
+    double floatNs = 0.0;
+    for (int layout = 0; layout < 2; layout++) {
+        bool packed = (layout == 1);
+        ReservoirBuffer source, destination;
+        source.resize(pixelCount, packed);
+        destination.resize(pixelCount, packed);
+        for (int p = 0; p < pixelCount; p++) {
+            RandomStream rng(RANDOM_SEED, 0, 0, p);
+            Reservoir r;
+            r.lightIndex = rng.nextInt(7);
+            r.M = 1 + rng.nextInt(600);
+            r.targetPdf = 1e-5f + rng.nextFloat() * 1e-2f;
+            r.weight = r.targetPdf * r.M * (0.5f + rng.nextFloat());
+            r.pixelOrigin = p;
+            source.set(p, r);
         }
         
-        // Modo biased original
-        int spatialSamples = 4;
-        int spatialRadius = 20;
-        for (int i = 0; i < spatialSamples; i++) {
-            float angle = randomFloat() * 2.0f * PI;
-            int dx = static_cast<int>(cos(angle) * (randomFloat() * spatialRadius));
-            int dy = static_cast<int>(sin(angle) * (randomFloat() * spatialRadius));
-            int nx = x + dx;
-            int ny = y + dy;
-            if (nx >= 0 && nx < WIDTH && ny >= 0 && ny < HEIGHT) {
-                int neighborIdx = ny * WIDTH + nx;
-                const Reservoir& neighborReservoir = reservoirs[neighborIdx];
-                reservoir.combine(neighborReservoir, scene.lights, point);
+        double best = 1e30;
+        float checksum = 0.0f;
+        for (int repetition = 0; repetition < 3; repetition++) {
+            double t0 = wallTime();
+#pragma omp parallel for schedule(static)
+            for (int y = 0; y < benchHeight; y++) {
+                for (int x = 0; x < benchWidth; x++) {
+                    int p = y * benchWidth + x;
+                    Reservoir r = source.get(p);
+                    for (int k = 0; k < 4; k++) {
+                        int nx = min(benchWidth - 1, max(0, x + offsetX[k]));
+                        int ny = min(benchHeight - 1, max(0, y + offsetY[k]));
+                        Reservoir neighbor = source.get(ny * benchWidth + nx);
+                        r.weight += neighbor.targetPdf * static_cast<float>(neighbor.M);
+                        r.M += neighbor.M;
+                    }
+                    destination.set(p, r);
+                }
             }
+            best = min(best, wallTime() - t0);
+            checksum += destination.get(pixelCount / 2).weight;
         }
+        double ns = best * 1e9 / pixelCount;
+        if (!packed) floatNs = ns;
+        double frameMB = static_cast<double>(pixelCount) * source.bytesPerPixel() / (1024.0 * 1024.0);
+        cout << setw(10) << (packed ? "compacto" : "float") << setw(14) << source.bytesPerPixel()
+             << setw(14) << fixed << setprecision(1) << frameMB << setw(12) << setprecision(2) << ns
+             << setw(12) << setprecision(2) << (2.0 * frameMB * 1024.0 * 1024.0 / best / 1e9);
+        if (packed) cout << "   (" << setprecision(2) << floatNs / ns << "x)";
+        cout << endl;
+        if (checksum == 12345.0f) cout << endl; // evita que o compilador descarte os laços
     }
+    cout << "(GB/s conta uma leitura e uma escrita do quadro; vizinhos vêm da cache)" << endl;
     
-    vector<Color> renderMonteCarlo() {
-        vector<Color> image(WIDTH * HEIGHT);
-        
-        cout << "Renderizando com MONTE CARLO PURO..." << endl;
-        cout << "Configuração:" << endl;
-        cout << "  MAX_CANDIDATES: " << MAX_CANDIDATES << endl;
-        cout << "  MODO: Monte Carlo Puro (sem RIS, sem reutilização)" << endl;
-        cout << "  Total de luzes: " << scene.lights.size() << endl;
-        cout << "  Total de esferas: " << scene.spheres.size() << endl;
-        
-        clock_t start = clock();
-        
+    // Erro de imagem do formato compacto em relação ao float, na mesma resolução
+    bool savedPacked = USE_PACKED_RESERVOIRS;
+    const int savedWidth = WIDTH, savedHeight = HEIGHT;
+    WIDTH = benchWidth;
+    HEIGHT = benchHeight;
+    vector<Color> images[2];
+    for (int layout = 0; layout < 2; layout++) {
+        USE_PACKED_RESERVOIRS = (layout == 1);
+        ReSTIRRenderer renderer;
+        for (int frame = 0; frame < 3; frame++) renderer.render(RenderConfig(), images[layout]);
+    }
+    USE_PACKED_RESERVOIRS = savedPacked;
+    
+    double maxError = 0.0, relMSE = 0.0;
+    int visiblyDifferent = 0;
+    for (size_t i = 0; i < images[0].size(); i++) {
+        Color a = images[0][i], b = images[1][i];
+        maxError = max(maxError, static_cast<double>(max(fabs(a.r - b.r), max(fabs(a.g - b.g), fabs(a.b - b.b)))));
+        double ref = a.luminance();
+        double diff = b.luminance() - ref;
+        relMSE += diff * diff / (ref * ref + 1e-4);
+        a.clamp();
+        b.clamp();
+        if (static_cast<int>(a.r * 255) != static_cast<int>(b.r * 255) ||
+            static_cast<int>(a.g * 255) != static_cast<int>(b.g * 255) ||
+            static_cast<int>(a.b * 255) != static_cast<int>(b.b * 255)) {
+            visiblyDifferent++;
+        }
+    }
+    relMSE /= images[0].size();
+    cout << endl << "=== Erro de imagem: compacto x float (" << WIDTH << "x" << HEIGHT << ", 3 quadros, "
+         << (USE_UNBIASED_MODE ? "unbiased" : "biased") << ") ===" << endl;
+    cout << "  MSE:                 " << scientific << setprecision(3) << computeMSE(images[1], images[0]) << endl;
+    cout << "  relMSE (luminância): " << relMSE << endl;
+    cout << "  erro absoluto máximo: " << maxError << fixed << endl;
+    cout << "  pixels com PPM diferente: " << visiblyDifferent << " de " << images[0].size()
+         << " (" << setprecision(3) << 100.0 * visiblyDifferent / images[0].size() << "%)" << endl;
+    WIDTH = savedWidth;
+    HEIGHT = savedHeight;
+}
+
+// Alocações e tempo da reutilização espacial unbiased: vetores por pixel (forma
+// antiga, reproduzida aqui) x combinação em buffer fixo na pilha. Também
+// verifica que amostras ocluídas nunca são escolhidas; retorna se passou.
+bool runUnbiasedReuseBenchmark() {
+    bool savedUnbiased = USE_UNBIASED_MODE;
+    USE_UNBIASED_MODE = true;
+    ReSTIRRenderer renderer;
+    renderer.ensureGBuffer();
+    const int pixelCount = WIDTH * HEIGHT;
+    
+    ReservoirBuffer frame;
+    frame.resize(pixelCount, false);
+    for (int p = 0; p < pixelCount; p++) {
+        Reservoir r;
+        r.pixelOrigin = p;
+        RandomStream rng(RANDOM_SEED, 0, PASS_INITIAL_RIS, p);
+        renderer.generateCandidates(r, renderer.lightingAt(p), MAX_CANDIDATES, rng);
+        frame.set(p, r);
+    }
+    
+    cout << endl << "=== Benchmark reutilização espacial unbiased (" << WIDTH << "x" << HEIGHT << ", "
+         << MAX_CANDIDATES << " candidatos) ===" << endl;
+#ifndef RESTIR_COUNT_ALLOCATIONS
+    cout << "(alocações não contadas neste build, as colunas ficam em 0: compile com -DRESTIR_COUNT_ALLOCATIONS"
+         << " ou use o restir_bench do CMake)" << endl;
+#endif
+    cout << setw(16) << "caminho" << setw(14) << "alocações" << setw(14) << "aloc/pixel" << setw(12) << "ms" << endl;
+    vector<Reservoir> results[2];
+    for (int path = 0; path < 2; path++) {
+        results[path].resize(pixelCount);
+        allocationCount = 0;
+        COUNT_ALLOCATIONS = true;
+        double t0 = wallTime();
+#pragma omp parallel for schedule(dynamic, 1)
         for (int y = 0; y < HEIGHT; y++) {
-            if (y % 50 == 0) {
-                cout << "Linha " << y << "/" << HEIGHT
-                     << " (" << fixed << setprecision(1)
-                     << (static_cast<float>(y) / HEIGHT * 100) << "%)" << endl;
-            }
-            
             for (int x = 0; x < WIDTH; x++) {
-                int pixelIndex = y * WIDTH + x;
-                SurfacePoint point = createSurfacePoint(static_cast<float>(x), static_cast<float>(y));
-                
-                MonteCarloReservoir mcReservoir;
-                
-                for (int i = 0; i < MAX_CANDIDATES; i++) {
-                    int lightIndex = randomInt(static_cast<int>(scene.lights.size()));
-                    mcReservoir.update(scene.lights, point, lightIndex);
+                int p = y * WIDTH + x;
+                Reservoir reservoir = frame.get(p);
+                RandomStream rng(RANDOM_SEED, 0, PASS_SPATIAL, p);
+                if (path == 1) {
+                    renderer.spatialReuseUnbiasedMISCorrected(reservoir, renderer.lightingAt(p), x, y, frame, rng);
+                } else {
+                    vector<Reservoir> inputReservoirs;
+                    vector<int> pixelOrigins;
+                    inputReservoirs.push_back(reservoir);
+                    pixelOrigins.push_back(p);
+                    for (int i = 0; i < 3; i++) {
+                        float angle = rng.nextFloat() * 2.0f * PI;
+                        int dx = static_cast<int>(cos(angle) * (rng.nextFloat() * 20));
+                        int dy = static_cast<int>(sin(angle) * (rng.nextFloat() * 20));
+                        int nx = x + dx;
+                        int ny = y + dy;
+                        if (nx >= 0 && nx < WIDTH && ny >= 0 && ny < HEIGHT) {
+                            Reservoir neighbor = frame.get(ny * WIDTH + nx);
+                            if (neighbor.lightIndex >= 0 && neighbor.M > 0) {
+                                inputReservoirs.push_back(neighbor);
+                                pixelOrigins.push_back(ny * WIDTH + nx);
+                            }
+                        }
+                    }
+                    reservoir = combineReservoirsUnbiasedMISCorrected(p, inputReservoirs, pixelOrigins,
+                                                                      renderer.surfacePoints, renderer.scene.lights, rng);
                 }
-                
-                Color finalColor = mcReservoir.getFinalColor();
-                Color ambient = point.albedo * 0.005f;
-                finalColor += ambient;
-                image[pixelIndex] = finalColor;
+                results[path][p] = reservoir;
             }
         }
-        
-        clock_t end = clock();
-        double duration = static_cast<double>(end - start) / CLOCKS_PER_SEC;
-        cout << "Renderização Monte Carlo concluída em " << duration << " segundos" << endl;
-        return image;
+        double elapsed = wallTime() - t0;
+        COUNT_ALLOCATIONS = false;
+        cout << setw(16) << (path == 1 ? "pilha (novo)" : "vetores") << setw(14) << allocationCount
+             << setw(14) << fixed << setprecision(2) << static_cast<double>(allocationCount) / pixelCount
+             << setw(12) << setprecision(1) << elapsed * 1000.0 << endl;
     }
     
-    vector<Color> render() {
-        if (USE_MONTE_CARLO_ONLY) {
-            return renderMonteCarlo();
-        }
-        
-        vector<Color> image(WIDTH * HEIGHT);
-        vector<Reservoir> currentFrame(WIDTH * HEIGHT);
-        
-        // MODIFICAÇÃO: Verificar se deve gerar baseline RIS interno
-        if (BASELINE_RIS_SAMPLES > 0) {
-            cout << "MODO BASELINE RIS INTERNO ATIVADO" << endl;
-            baselineImage = renderRISBaseline(BASELINE_RIS_SAMPLES);
-            hasBaselineImage = true;
-            USE_BASELINE_IMAGE = true; // Forçar uso do baseline gerado
+    int mismatches = 0;
+    for (int p = 0; p < pixelCount; p++) {
+        const Reservoir& a = results[0][p];
+        const Reservoir& b = results[1][p];
+        if (a.lightIndex != b.lightIndex || a.M != b.M || a.weight != b.weight || a.targetPdf != b.targetPdf) mismatches++;
+    }
+    cout << "  reservatórios diferentes entre os caminhos: " << mismatches << endl;
+    
+    // Reutilização de visibilidade no modo unbiased: com as amostras das luzes
+    // pares marcadas como ocluídas, nenhuma delas pode ser escolhida, embora o
+    // alvo seja reavaliado no pixel de destino (espacial e combine() unbiased)
+    ReservoirBuffer occludedFrame;
+    occludedFrame.resize(pixelCount, false);
+    for (int p = 0; p < pixelCount; p++) {
+        Reservoir r = frame.get(p);
+        if (r.lightIndex >= 0 && r.lightIndex % 2 == 0) r.markOccluded();
+        occludedFrame.set(p, r);
+    }
+    int occludedChosen = 0;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+:occludedChosen)
+    for (int y = 0; y < HEIGHT; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            int p = y * WIDTH + x;
+            PixelLighting lighting = renderer.lightingAt(p);
+            RandomStream rng(RANDOM_SEED, 0, PASS_SPATIAL, p);
+            Reservoir spatial = occludedFrame.get(p);
+            renderer.spatialReuseUnbiasedMISCorrected(spatial, lighting, x, y, occludedFrame, rng);
+            Reservoir combined;
+            combined.combine(occludedFrame.get(p), lighting, rng, true);
+            combined.combine(occludedFrame.get(y * WIDTH + (x + 1) % WIDTH), lighting, rng, true);
+            if (spatial.lightIndex >= 0 && spatial.lightIndex % 2 == 0) occludedChosen++;
+            if (combined.lightIndex >= 0 && combined.lightIndex % 2 == 0) occludedChosen++;
         }
-        
-        cout << "Renderizando com ReSTIR " << (USE_UNBIASED_MODE ? "UNBIASED CORRIGIDO" : "BIASED") << " + ESFERAS OTIMIZADAS..." << endl;
-        cout << "Configuração:" << endl;
-        cout << "  MAX_CANDIDATES: " << MAX_CANDIDATES << endl;
-        cout << "  AMOSTRAGEM_ESPACIAL: " << (ENABLE_SPATIAL_REUSE ? "ATIVADA" : "DESATIVADA") << endl;
-        cout << "  AMOSTRAGEM_TEMPORAL: " << (ENABLE_TEMPORAL_REUSE ? "ATIVADA" : "DESATIVADA") << endl;
-        
-        if (BASELINE_RIS_SAMPLES > 0) {
-            cout << "  BASELINE_RIS: ATIVADA (" << BASELINE_RIS_SAMPLES << " amostras)" << endl;
-        } else {
-            cout << "  BASELINE_IMAGE: " << (USE_BASELINE_IMAGE && hasBaselineImage ? "ATIVADA" : "DESATIVADA") << endl;
+    }
+    cout << "  amostras ocluídas escolhidas (unbiased, esperado 0): " << occludedChosen << endl;
+    if (occludedChosen > 0) cerr << "Erro: a reutilização unbiased escolheu amostras ocluídas" << endl;
+    
+    // Quadro completo (RIS + temporal + espacial + sombreamento): as alocações
+    // restantes são dos buffers por quadro, não dos laços por pixel
+    renderer.render();
+    allocationCount = 0;
+    COUNT_ALLOCATIONS = true;
+    renderer.render();
+    COUNT_ALLOCATIONS = false;
+    cout << "  render() completo (2o quadro): " << allocationCount << " alocações ("
+         << setprecision(4) << static_cast<double>(allocationCount) / pixelCount << " por pixel)" << endl;
+    USE_UNBIASED_MODE = savedUnbiased;
+    return occludedChosen == 0;
+}
+
+// Resultado dos benchmarks em JSON no arquivo BENCHMARK_JSON_FILE ("-" = saída padrão)
+bool writeBenchmarkJSON(const string& json) {
+    if (BENCHMARK_JSON_FILE == "-") {
+        cout << json;
+        return true;
+    }
+    ofstream file(BENCHMARK_JSON_FILE.c_str());
+    file << json;
+    if (!file) {
+        cerr << "Erro: não foi possível gravar " << BENCHMARK_JSON_FILE << endl;
+        return false;
+    }
+    cout << "Resultados gravados em " << BENCHMARK_JSON_FILE << endl;
+    return true;
+}
+
+// Descarta o que for escrito no stream (mensagens por quadro durante o benchmark)
+class NullStreamBuffer : public streambuf {
+protected:
+    int overflow(int c) { return c; }
+};
+
+// Kernels quentes medidos isoladamente pelo benchmark de regressão (restir_bench)
+enum HotKernel {
+    HOT_SPHERE_INTERSECT = 0,
+    HOT_CREATE_SURFACE_POINT,
+    HOT_RESERVOIR_UPDATE,
+    HOT_RESERVOIR_COMBINE,
+    HOT_COMBINE_UNBIASED_MIS,
+    HOT_SPATIAL_REUSE,
+    HOT_SHADOW_RAY,
+    HOT_RENDER_FRAME,
+    HOT_RENDER_MONTE_CARLO,
+    HOT_KERNEL_COUNT
+};
+
+const char* hotKernelName(int kernel) {
+    static const char* names[HOT_KERNEL_COUNT] = {
+        "sphere_intersect", "create_surface_point", "reservoir_update", "reservoir_combine",
+        "combine_unbiased_mis", "spatial_reuse", "shadow_ray", "render_frame", "render_monte_carlo"
+    };
+    return names[kernel];
+}
+
+// Executa o kernel uma vez sobre todos os pixels e devolve o tempo de parede.
+// "checksum" acumula os resultados para o compilador não descartar os laços;
+// "callsPerPixel" informa quantas chamadas do kernel cada pixel fez.
+double timeHotKernel(ReSTIRRenderer& renderer, const ReservoirBuffer& frame, int kernel,
+                     double& checksum, double& callsPerPixel) {
+    const Scene& scene = renderer.scene;
+    const int sphereCount = static_cast<int>(scene.spheres.size());
+    const int lightCount = static_cast<int>(scene.lights.size());
+    double sum = 0.0;
+    callsPerPixel = 1.0;
+    double t0 = wallTime();
+    switch (kernel) {
+    case HOT_SPHERE_INTERSECT:
+        // Raio primário de cada pixel contra todas as esferas (sem BVH)
+        callsPerPixel = sphereCount;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+:sum)
+        for (int y = 0; y < HEIGHT; y++) {
+            for (int x = 0; x < WIDTH; x++) {
+                Vec3 rayOrigin(static_cast<float>(x) - WIDTH/2, static_cast<float>(y) - HEIGHT/2, 100);
+                Vec3 rayDir(0, 0, -1);
+                float closest = 1e30f;
+                for (int s = 0; s < sphereCount; s++) {
+                    float t = scene.spheres[s].intersect(rayOrigin, rayDir);
+                    if (t > 0 && t < closest) closest = t;
+                }
+                if (closest < 1e30f) sum += closest;
+            }
         }
-        
-        cout << "  MODO: " << (USE_UNBIASED_MODE ? "UNBIASED CORRIGIDO - SEM ESCURECIMENTO" : "BIASED") << endl;
-        cout << "  Total de luzes: " << scene.lights.size() << endl;
-        cout << "  Total de esferas: " << scene.spheres.size() << endl;
-        
-        clock_t start = clock();
-        
-        // Passo 1: Gerar pontos de superfície e RIS inicial
+        break;
+    case HOT_CREATE_SURFACE_POINT:
+#pragma omp parallel for schedule(dynamic, 1) reduction(+:sum)
         for (int y = 0; y < HEIGHT; y++) {
-            if (y % 50 == 0) {
-                cout << "Linha " << y << "/" << HEIGHT
-                     << " (" << fixed << setprecision(1)
-                     << (static_cast<float>(y) / HEIGHT * 100) << "%)" << endl;
+            for (int x = 0; x < WIDTH; x++) {
+                sum += renderer.createSurfacePoint(static_cast<float>(x), static_cast<float>(y)).position.z;
             }
+        }
+        break;
+    case HOT_RESERVOIR_UPDATE:
+        // MAX_CANDIDATES candidatos uniformes por pixel, um update() por candidato
+        callsPerPixel = MAX_CANDIDATES;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+:sum)
+        for (int y = 0; y < HEIGHT; y++) {
             for (int x = 0; x < WIDTH; x++) {
-                int pixelIndex = y * WIDTH + x;
-                SurfacePoint point = createSurfacePoint(static_cast<float>(x), static_cast<float>(y));
-                surfacePoints[pixelIndex] = point;
-                
+                int p = y * WIDTH + x;
+                PixelLighting lighting = renderer.lightingAt(p);
+                RandomStream rng(RANDOM_SEED, 0, PASS_INITIAL_RIS, p);
                 Reservoir reservoir;
-                reservoir.pixelOrigin = pixelIndex;
-                
                 for (int i = 0; i < MAX_CANDIDATES; i++) {
-                    int lightIndex = randomInt(static_cast<int>(scene.lights.size()));
-                    reservoir.update(scene.lights, point, lightIndex);
-                }
-                
-                // Reutilização temporal
-                if (ENABLE_TEMPORAL_REUSE) {
-                    if (hasBaselineImage && USE_BASELINE_IMAGE &&
-                        pixelIndex >= 0 && pixelIndex < static_cast<int>(baselineImage.size())) {
-                        Color baselineColor = baselineImage[pixelIndex];
-                        Reservoir baselineReservoir = reconstructReservoirFromBaseline(baselineColor, point, pixelIndex);
-                        
-                        if (USE_UNBIASED_MODE) {
-                            // Usar combinação corrigida para temporal também
-                            vector<Reservoir> tempReservoirs;
-                            vector<int> tempOrigins;
-                            tempReservoirs.push_back(reservoir);
-                            tempReservoirs.push_back(baselineReservoir);
-                            tempOrigins.push_back(pixelIndex);
-                            tempOrigins.push_back(pixelIndex);
-                            
-                            reservoir = combineReservoirsUnbiasedMISCorrected(pixelIndex, tempReservoirs, tempOrigins, surfacePoints, scene.lights);
-                        } else {
-                            reservoir.combine(baselineReservoir, scene.lights, point);
-                        }
-                    } else if (pixelIndex >= 0 && pixelIndex < static_cast<int>(previousFrame.size())) {
-                        // Limitação temporal conforme artigo (M anterior <= 20 * M atual)
-                        Reservoir tempReservoir = previousFrame[pixelIndex];
-                        if (tempReservoir.M > 20 * reservoir.M) {
-                            tempReservoir.M = 20 * reservoir.M;
-                            tempReservoir.weight = tempReservoir.targetPdf * static_cast<float>(tempReservoir.M);
-                        }
-                        
-                        if (USE_UNBIASED_MODE) {
-                            vector<Reservoir> tempReservoirs;
-                            vector<int> tempOrigins;
-                            tempReservoirs.push_back(reservoir);
-                            tempReservoirs.push_back(tempReservoir);
-                            tempOrigins.push_back(pixelIndex);
-                            tempOrigins.push_back(tempReservoir.pixelOrigin);
-                            
-                            reservoir = combineReservoirsUnbiasedMISCorrected(pixelIndex, tempReservoirs, tempOrigins, surfacePoints, scene.lights);
-                        } else {
-                            reservoir.combine(tempReservoir, scene.lights, point);
-                        }
-                    }
+                    reservoir.update(lighting, rng.nextInt(lightCount), 1.0f / lightCount, rng);
                 }
-                currentFrame[pixelIndex] = reservoir;
+                sum += reservoir.weight;
+            }
+        }
+        break;
+    case HOT_RESERVOIR_COMBINE:
+        // Quatro vizinhos imediatos por pixel (combine segue o modo biased/unbiased)
+        callsPerPixel = 4;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+:sum)
+        for (int y = 0; y < HEIGHT; y++) {
+            for (int x = 0; x < WIDTH; x++) {
+                int p = y * WIDTH + x;
+                PixelLighting lighting = renderer.lightingAt(p);
+                RandomStream rng(RANDOM_SEED, 0, PASS_SPATIAL, p);
+                Reservoir reservoir = frame.get(p);
+                reservoir.combine(frame.get(y * WIDTH + max(x - 1, 0)), lighting, rng, USE_UNBIASED_MODE);
+                reservoir.combine(frame.get(y * WIDTH + min(x + 1, WIDTH - 1)), lighting, rng, USE_UNBIASED_MODE);
+                reservoir.combine(frame.get(max(y - 1, 0) * WIDTH + x), lighting, rng, USE_UNBIASED_MODE);
+                reservoir.combine(frame.get(min(y + 1, HEIGHT - 1) * WIDTH + x), lighting, rng, USE_UNBIASED_MODE);
+                sum += reservoir.weight;
+            }
+        }
+        break;
+    case HOT_COMBINE_UNBIASED_MIS:
+        // O próprio reservatório e três vizinhos, pela interface de bloco fixo
+        callsPerPixel = 1;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+:sum)
+        for (int y = 0; y < HEIGHT; y++) {
+            for (int x = 0; x < WIDTH; x++) {
+                int p = y * WIDTH + x;
+                RandomStream rng(RANDOM_SEED, 0, PASS_SPATIAL, p);
+                Reservoir inputs[4];
+                inputs[0] = frame.get(p);
+                inputs[1] = frame.get(y * WIDTH + max(x - 1, 0));
+                inputs[2] = frame.get(y * WIDTH + min(x + 1, WIDTH - 1));
+                inputs[3] = frame.get(max(y - 1, 0) * WIDTH + x);
+                Reservoir reservoir = combineReservoirsUnbiasedMISCorrected(p, inputs, 4, renderer.surfacePoints,
+                                                                            scene.lights, rng);
+                sum += reservoir.weight;
+            }
+        }
+        break;
+    case HOT_SPATIAL_REUSE:
+#pragma omp parallel for schedule(dynamic, 1) reduction(+:sum)
+        for (int y = 0; y < HEIGHT; y++) {
+            for (int x = 0; x < WIDTH; x++) {
+                int p = y * WIDTH + x;
+                RandomStream rng(RANDOM_SEED, 0, PASS_SPATIAL, p);
+                Reservoir reservoir = frame.get(p);
+                renderer.spatialReuse(reservoir, renderer.lightingAt(p), x, y, frame, rng);
+                sum += reservoir.weight;
+            }
+        }
+        break;
+    case HOT_SHADOW_RAY:
+        // Um raio de sombra por pixel (consulta de oclusão na BVH), luz em rodízio
+#pragma omp parallel for schedule(dynamic, 1) reduction(+:sum)
+        for (int y = 0; y < HEIGHT; y++) {
+            for (int x = 0; x < WIDTH; x++) {
+                int p = y * WIDTH + x;
+                if (renderer.isVisible(renderer.surfacePoints[p], p % lightCount)) sum += 1.0;
             }
         }
+        break;
+    case HOT_RENDER_FRAME: {
+        vector<Color> image = renderer.render();
+        for (size_t i = 0; i < image.size(); i++) sum += image[i].r;
+        break;
+    }
+    case HOT_RENDER_MONTE_CARLO: {
+        vector<Color> image = renderer.renderMonteCarlo();
+        for (size_t i = 0; i < image.size(); i++) sum += image[i].r;
+        break;
+    }
+    }
+    double elapsed = wallTime() - t0;
+    checksum += sum;
+    return elapsed;
+}
+
+// Benchmark de regressão dos kernels quentes: melhor de "repeats" execuções de
+// cada kernel (após uma de aquecimento) na configuração atual, em ns/pixel e
+// pixels/s, gravado em JSON (BENCHMARK_JSON_FILE; "-" = saída padrão)
+bool runHotKernelBenchmark() {
+    const int repeats = 3;
+    // As mensagens de render() (configuração, progresso dos blocos) ficam fora
+    // do tempo medido e da saída: só a tabela e o JSON vão para o console
+    NullStreamBuffer nullBuffer;
+    streambuf* console = cout.rdbuf();
+    cout.rdbuf(&nullBuffer);
+    ReSTIRRenderer renderer(SCENE_FILE.empty());
+    if (!SCENE_FILE.empty() && !SceneFile::load(SCENE_FILE, renderer.scene)) {
+        cout.rdbuf(console);
+        return false;
+    }
+    renderer.ensureGBuffer();
+    const int pixelCount = WIDTH * HEIGHT;
+    
+    // Quadro de reservatórios RIS que alimenta os kernels de combinação
+    ReservoirBuffer frame;
+    frame.resize(pixelCount, false);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int p = 0; p < pixelCount; p++) {
+        Reservoir reservoir;
+        reservoir.pixelOrigin = p;
+        RandomStream rng(RANDOM_SEED, 0, PASS_INITIAL_RIS, p);
+        renderer.generateCandidates(reservoir, renderer.lightingAt(p), MAX_CANDIDATES, rng);
+        frame.set(p, reservoir);
+    }
+    
+    double best[HOT_KERNEL_COUNT];
+    double calls[HOT_KERNEL_COUNT];
+    double checksum = 0.0;
+    for (int kernel = 0; kernel < HOT_KERNEL_COUNT; kernel++) {
+        best[kernel] = 1e30;
+        for (int run = 0; run <= repeats; run++) {
+            double seconds = timeHotKernel(renderer, frame, kernel, checksum, calls[kernel]);
+            if (run > 0) best[kernel] = min(best[kernel], seconds);
+        }
+    }
+    cout.rdbuf(console);
+    
+#ifdef _OPENMP
+    int threads = omp_get_max_threads();
+#else
+    int threads = 1;
+#endif
+    cout << endl << "=== Benchmark kernels quentes (" << WIDTH << "x" << HEIGHT << ", " << MAX_CANDIDATES
+         << " candidatos, " << (USE_UNBIASED_MODE ? "unbiased" : "biased") << ", " << threads << " threads) ===" << endl;
+    cout << setw(24) << "kernel" << setw(14) << "ns/pixel" << setw(16) << "Mpixels/s" << endl;
+    for (int kernel = 0; kernel < HOT_KERNEL_COUNT; kernel++) {
+        cout << setw(24) << hotKernelName(kernel) << setw(14) << fixed << setprecision(1) << best[kernel] * 1e9 / pixelCount
+             << setw(16) << setprecision(3) << pixelCount / best[kernel] * 1e-6 << endl;
+    }
+    
+    ostringstream json;
+    json << fixed << setprecision(3);
+    json << "{" << endl;
+    json << "  \"width\": " << WIDTH << "," << endl;
+    json << "  \"height\": " << HEIGHT << "," << endl;
+    json << "  \"pixels\": " << pixelCount << "," << endl;
+    json << "  \"candidates\": " << MAX_CANDIDATES << "," << endl;
+    json << "  \"unbiased\": " << (USE_UNBIASED_MODE ? "true" : "false") << "," << endl;
+    json << "  \"lights\": " << renderer.scene.lights.size() << "," << endl;
+    json << "  \"spheres\": " << renderer.scene.spheres.size() << "," << endl;
+    json << "  \"threads\": " << threads << "," << endl;
+    json << "  \"sphere_kernel\": \"" << sphereKernelName(SPHERE_KERNEL >= 0 ? static_cast<SphereKernelType>(SPHERE_KERNEL) : detectSphereKernel()) << "\"," << endl;
+    json << "  \"light_cache\": " << (renderer.lightCache.enabled ? "true" : "false") << "," << endl;
+    json << "  \"repeats\": " << repeats << "," << endl;
+    json << "  \"kernels\": [" << endl;
+    for (int kernel = 0; kernel < HOT_KERNEL_COUNT; kernel++) {
+        double nsPerPixel = best[kernel] * 1e9 / pixelCount;
+        json << "    {\"name\": \"" << hotKernelName(kernel) << "\", \"seconds\": " << setprecision(6) << best[kernel]
+             << ", \"ns_per_pixel\": " << setprecision(3) << nsPerPixel
+             << ", \"ns_per_call\": " << nsPerPixel / calls[kernel]
+             << ", \"calls_per_pixel\": " << setprecision(0) << calls[kernel]
+             << ", \"pixels_per_second\": " << pixelCount / best[kernel] << "}"
+             << (kernel + 1 < HOT_KERNEL_COUNT ? "," : "") << endl;
+    }
+    json << "  ]," << endl;
+    json << "  \"checksum\": " << setprecision(6) << checksum << endl;
+    json << "}" << endl;
+    
+    return writeBenchmarkJSON(json.str());
+}
+
+// Configuração do benchmark de convergência: método e candidatos por quadro
+struct ConvergenceConfig {
+    string method; // mc, ris, biased ou unbiased
+    int candidates;
+};
+
+// Lista "método:candidatos,..." (ex.: "mc:32,ris:8,unbiased:8")
+bool parseConvergenceConfigs(const string& list, vector<ConvergenceConfig>& configs) {
+    configs.clear();
+    stringstream stream(list);
+    string item;
+    while (getline(stream, item, ',')) {
+        size_t colon = item.find(':');
+        ConvergenceConfig config;
+        config.method = item.substr(0, colon);
+        config.candidates = (colon == string::npos) ? 0 : atoi(item.c_str() + colon + 1);
+        if ((config.method != "mc" && config.method != "ris" && config.method != "biased" && config.method != "unbiased") ||
+            config.candidates <= 0) {
+            cerr << "Erro: configuração inválida '" << item << "' (use mc|ris|biased|unbiased:<candidatos>)" << endl;
+            return false;
+        }
+        configs.push_back(config);
+    }
+    return !configs.empty();
+}
+
+// Erros de uma imagem contra a referência: MSE por canal, MSE relativo
+// ((x - ref)^2 / (ref^2 + 0.01)) e viés (diferença da luminância média)
+void computeErrorStats(const vector<Color>& image, const vector<Color>& reference,
+                       double& mse, double& relMSE, double& bias) {
+    double squared = 0.0, relative = 0.0, luminance = 0.0;
+    for (size_t i = 0; i < image.size(); i++) {
+        const Color& a = image[i];
+        const Color& b = reference[i];
+        double d[3] = { a.r - b.r, a.g - b.g, a.b - b.b };
+        double ref[3] = { b.r, b.g, b.b };
+        for (int c = 0; c < 3; c++) {
+            squared += d[c] * d[c];
+            relative += d[c] * d[c] / (ref[c] * ref[c] + 0.01);
+        }
+        luminance += a.luminance() - b.luminance();
+    }
+    double samples = image.empty() ? 1.0 : 3.0 * image.size();
+    mse = squared / samples;
+    relMSE = relative / samples;
+    bias = image.empty() ? 0.0 : luminance / image.size();
+}
+
+// Benchmark de convergência: a referência é a média de REFERENCE_FRAMES quadros
+// de RIS puro com REFERENCE_SAMPLES candidatos (um único quadro RIS ainda tem o
+// ruído da escolha de uma luz por pixel). Para cada configuração, a estimativa é
+// a média dos quadros renderizados dentro do orçamento de tempo (TIME_BUDGET) ou
+// de candidatos por pixel (SAMPLE_BUDGET), partindo sem histórico temporal. A
+// reutilização segue as opções -s/-t da linha de comando.
+bool runConvergenceBenchmark() {
+    vector<ConvergenceConfig> configs;
+    if (!parseConvergenceConfigs(CONVERGENCE_CONFIGS, configs)) return false;
+    
+    // Reutilização espacial/temporal segue a linha de comando; sem baselines
+    RenderConfig baseConfig;
+    baseConfig.useBaselineImage = false;
+    baseConfig.baselineRisSamples = 0;
+    string savedCheckpoint = CHECKPOINT_FILE;
+    CHECKPOINT_FILE.clear();
+    
+    ReSTIRRenderer renderer(SCENE_FILE.empty());
+    if (!SCENE_FILE.empty() && !SceneFile::load(SCENE_FILE, renderer.scene)) return false;
+    NullStreamBuffer nullBuffer;
+    streambuf* console = cout.rdbuf();
+    const int pixelCount = WIDTH * HEIGHT;
+    
+    cout << "Gerando referência (" << REFERENCE_FRAMES << " quadros de RIS puro com " << REFERENCE_SAMPLES
+         << " candidatos)..." << endl;
+    cout.rdbuf(&nullBuffer);
+    double referenceStart = wallTime();
+    vector<Color> reference(pixelCount, Color(0, 0, 0));
+    for (int f = 0; f < REFERENCE_FRAMES; f++) {
+        vector<Color> image = renderer.renderRISBaseline(REFERENCE_SAMPLES);
+        for (int p = 0; p < pixelCount; p++) reference[p] += image[p];
+    }
+    for (int p = 0; p < pixelCount; p++) reference[p] = reference[p] * (1.0f / REFERENCE_FRAMES);
+    double referenceSeconds = wallTime() - referenceStart;
+    cout.rdbuf(console);
+    
+    vector<int> frames(configs.size());
+    vector<double> seconds(configs.size()), mse(configs.size()), relMSE(configs.size()), bias(configs.size());
+    for (size_t c = 0; c < configs.size(); c++) {
+        const ConvergenceConfig& config = configs[c];
+        RenderConfig renderConfig = baseConfig;
+        renderConfig.monteCarlo = (config.method == "mc");
+        renderConfig.unbiased = (config.method == "unbiased");
+        renderConfig.maxCandidates = config.candidates;
+        renderer.previousFrame = ReservoirBuffer();
+        
+        vector<Color> accumulated(pixelCount, Color(0, 0, 0));
+        cout << "  " << config.method << ":" << config.candidates << "..." << flush;
+        cout.rdbuf(&nullBuffer);
+        double start = wallTime();
+        int count = 0;
+        for (;;) {
+            vector<Color> image = (config.method == "ris") ? renderer.renderRISBaseline(config.candidates) : renderer.render(renderConfig);
+            for (int p = 0; p < pixelCount; p++) accumulated[p] += image[p];
+            count++;
+            if (SAMPLE_BUDGET > 0 ? count * config.candidates >= SAMPLE_BUDGET : wallTime() - start >= TIME_BUDGET) break;
+        }
+        seconds[c] = wallTime() - start;
+        cout.rdbuf(console);
+        frames[c] = count;
+        for (int p = 0; p < pixelCount; p++) accumulated[p] = accumulated[p] * (1.0f / count);
+        computeErrorStats(accumulated, reference, mse[c], relMSE[c], bias[c]);
+        cout << " " << count << " quadros" << endl;
+    }
+    
+    CHECKPOINT_FILE = savedCheckpoint;
+    
+    cout << endl << "=== Benchmark de convergência (" << WIDTH << "x" << HEIGHT << ", ";
+    if (SAMPLE_BUDGET > 0) cout << SAMPLE_BUDGET << " candidatos/pixel";
+    else cout << fixed << setprecision(2) << TIME_BUDGET << " s";
+    cout << " por configuração; referência " << REFERENCE_FRAMES << "x RIS " << REFERENCE_SAMPLES << ") ===" << endl;
+    cout << setw(14) << "config" << setw(9) << "quadros" << setw(11) << "tempo(s)" << setw(13) << "MSE"
+         << setw(13) << "relMSE" << setw(13) << "viés" << setw(16) << "1/(MSE*tempo)" << endl;
+    for (size_t c = 0; c < configs.size(); c++) {
+        ostringstream name;
+        name << configs[c].method << ":" << configs[c].candidates;
+        cout << setw(14) << name.str() << setw(9) << frames[c] << setw(11) << fixed << setprecision(3) << seconds[c]
+             << scientific << setprecision(3) << setw(13) << mse[c] << setw(13) << relMSE[c] << setw(13) << bias[c]
+             << setw(16) << 1.0 / (mse[c] * seconds[c]) << fixed << endl;
+    }
+    
+    ostringstream json;
+    json << "{" << endl;
+    json << "  \"width\": " << WIDTH << "," << endl;
+    json << "  \"height\": " << HEIGHT << "," << endl;
+    json << "  \"reference_samples\": " << REFERENCE_SAMPLES << "," << endl;
+    json << "  \"reference_frames\": " << REFERENCE_FRAMES << "," << endl;
+    json << "  \"reference_seconds\": " << fixed << setprecision(6) << referenceSeconds << "," << endl;
+    if (SAMPLE_BUDGET > 0) json << "  \"sample_budget\": " << SAMPLE_BUDGET << "," << endl;
+    else json << "  \"time_budget_seconds\": " << TIME_BUDGET << "," << endl;
+    json << "  \"configs\": [" << endl;
+    for (size_t c = 0; c < configs.size(); c++) {
+        json << "    {\"method\": \"" << configs[c].method << "\", \"candidates\": " << configs[c].candidates
+             << ", \"frames\": " << frames[c] << ", \"seconds\": " << fixed << setprecision(6) << seconds[c]
+             << scientific << setprecision(6) << ", \"mse\": " << mse[c] << ", \"rel_mse\": " << relMSE[c]
+             << ", \"bias\": " << bias[c] << ", \"efficiency\": " << 1.0 / (mse[c] * seconds[c]) << "}"
+             << (c + 1 < configs.size() ? "," : "") << endl;
+    }
+    json << "  ]" << endl;
+    json << "}" << endl;
+    return writeBenchmarkJSON(json.str());
+}
+
+// Falhas na cache de último nível somadas nas threads do OpenMP, lidas dos
+// contadores de hardware via perf_event_open (Linux). Cada thread da equipe
+// abre o próprio contador; as threads do OpenMP persistem entre regiões
+// paralelas, então as leituras seguintes cobrem os mesmos trabalhadores.
+// available() é falso sem suporte do kernel, da VM ou sem permissão
+// (kernel.perf_event_paranoid); quem mede cai então para um modelo.
+class LLCMissCounter {
+public:
+    LLCMissCounter() : ok(false) {
+#ifdef __linux__
+#ifdef _OPENMP
+        int threads = omp_get_max_threads();
+#else
+        int threads = 1;
+#endif
+        descriptors.assign(threads, -1);
+        int opened = 0;
+#pragma omp parallel num_threads(threads) reduction(+:opened)
+        {
+#ifdef _OPENMP
+            int thread = omp_get_thread_num();
+#else
+            int thread = 0;
+#endif
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            descriptors[thread] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+            if (descriptors[thread] >= 0) opened++;
+        }
+        ok = (opened == threads);
+#endif
+    }
+    
+    ~LLCMissCounter() {
+#ifdef __linux__
+        for (size_t i = 0; i < descriptors.size(); i++) {
+            if (descriptors[i] >= 0) ::close(descriptors[i]);
+        }
+#endif
+    }
+    
+    bool available() const { return ok; }
+    
+    // Total acumulado desde a abertura (chamar fora de regiões paralelas)
+    unsigned long long read() const {
+        unsigned long long total = 0;
+#ifdef __linux__
+        for (size_t i = 0; i < descriptors.size(); i++) {
+            unsigned long long value = 0;
+            if (descriptors[i] >= 0 && ::read(descriptors[i], &value, sizeof(value)) == sizeof(value)) total += value;
+        }
+#endif
+        return total;
+    }
+    
+private:
+    LLCMissCounter(const LLCMissCounter&);
+    LLCMissCounter& operator=(const LLCMissCounter&);
+    
+    bool ok;
+    vector<int> descriptors;
+};
+
+// Tamanho da cache de último nível, para o modelo de tráfego do benchmark do
+// pipeline fundido; sem a informação do sistema, supõe 8 MB
+double lastLevelCacheBytes() {
+#if defined(_SC_LEVEL3_CACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE)
+    long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (l3 > 0) return static_cast<double>(l3);
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (l2 > 0) return static_cast<double>(l2);
+#endif
+    return 8.0 * 1024.0 * 1024.0;
+}
+
+// Pipeline fundido x três varreduras do quadro inteiro, na resolução atual e em
+// 1920x1080 e 3840x2160: tempo por quadro (melhor de "repeats", após um quadro
+// de aquecimento que monta o G-buffer) e tráfego de DRAM por quadro. O tráfego
+// medido vem das falhas de LLC (LLCMissCounter) dos quadros cronometrados, a 64
+// bytes por falha (sem as escritas de volta, que o contador não vê). Ao lado vai
+// sempre o valor de um modelo, o único disponível sem contadores de hardware:
+// escritas vão sempre à memória, e um dado relido por uma etapa seguinte volta
+// da DRAM se o que foi tocado entre a escrita e a leitura (o quadro inteiro nas
+// varreduras, a janela de faixas no fundido) não cabe na cache de último nível.
+// O modelo parte dessa hipótese, então não serve como verificação; só a coluna
+// medida serve. O último quadro dos dois modos parte da mesma história e é
+// comparado pixel a pixel.
+bool runFusedPipelineBenchmark() {
+    const int repeats = 3;
+    const double cacheLineBytes = 64.0;
+    const int savedWidth = WIDTH, savedHeight = HEIGHT;
+    string savedCheckpoint = CHECKPOINT_FILE;
+    CHECKPOINT_FILE.clear();
+    double cacheBytes = lastLevelCacheBytes();
+#ifdef _OPENMP
+    if (NUM_THREADS > 0) omp_set_num_threads(NUM_THREADS);
+#endif
+    LLCMissCounter missCounter;
+    
+    vector<int> widths, heights;
+    widths.push_back(WIDTH);
+    heights.push_back(HEIGHT);
+    if (1920 * 1080 > WIDTH * HEIGHT) { widths.push_back(1920); heights.push_back(1080); }
+    if (3840 * 2160 > WIDTH * HEIGHT) { widths.push_back(3840); heights.push_back(2160); }
+    
+    RenderConfig baseConfig;
+    baseConfig.useBaselineImage = false;
+    baseConfig.baselineRisSamples = 0;
+    baseConfig.monteCarlo = false;
+    int passes = baseConfig.spatialReuse ? baseConfig.spatialPasses : 0;
+    
+#ifdef _OPENMP
+    int threads = omp_get_max_threads();
+#else
+    int threads = 1;
+#endif
+    cout << endl << "=== Benchmark pipeline fundido x três varreduras (" << MAX_CANDIDATES << " candidatos, "
+         << passes << " passes espaciais, " << threads << " threads, cache " << fixed << setprecision(0)
+         << cacheBytes / (1024.0 * 1024.0) << " MB) ===" << endl;
+    if (!missCounter.available()) {
+        cout << "Contadores de hardware indisponíveis (perf_event_open): DRAM medida omitida, só o modelo" << endl;
+    }
+    cout << setw(12) << "resolução" << setw(10) << "modo" << setw(12) << "ms/quadro" << setw(14) << "reuso(MB)"
+         << setw(16) << "DRAM medida(MB)" << setw(16) << "DRAM modelo(MB)" << setw(12) << "idêntica" << endl;
+    
+    ostringstream json;
+    json << fixed << setprecision(3);
+    json << "{" << endl;
+    json << "  \"candidates\": " << MAX_CANDIDATES << "," << endl;
+    json << "  \"spatial_passes\": " << passes << "," << endl;
+    json << "  \"unbiased\": " << (baseConfig.unbiased ? "true" : "false") << "," << endl;
+    json << "  \"threads\": " << threads << "," << endl;
+    json << "  \"cache_bytes\": " << setprecision(0) << cacheBytes << setprecision(3) << "," << endl;
+    json << "  \"repeats\": " << repeats << "," << endl;
+    json << "  \"dram_measured\": " << (missCounter.available() ? "true" : "false") << "," << endl;
+    json << "  \"results\": [" << endl;
+    
+    bool allIdentical = true;
+    NullStreamBuffer nullBuffer;
+    streambuf* console = cout.rdbuf();
+    for (size_t r = 0; r < widths.size(); r++) {
+        WIDTH = widths[r];
+        HEIGHT = heights[r];
+        double pixels = static_cast<double>(WIDTH) * HEIGHT;
+        cout.rdbuf(&nullBuffer);
+        ReSTIRRenderer renderer(SCENE_FILE.empty());
+        if (!SCENE_FILE.empty() && !SceneFile::load(SCENE_FILE, renderer.scene)) {
+            cout.rdbuf(console);
+            WIDTH = savedWidth;
+            HEIGHT = savedHeight;
+            CHECKPOINT_FILE = savedCheckpoint;
+            return false;
+        }
         
-        // Passo 2: Reutilização espacial
-        if (ENABLE_SPATIAL_REUSE) {
-            vector<Reservoir> spatialFrame = currentFrame;
-            for (int y = 0; y < HEIGHT; y++) {
-                for (int x = 0; x < WIDTH; x++) {
-                    int pixelIndex = y * WIDTH + x;
-                    SurfacePoint point = surfacePoints[pixelIndex];
-                    Reservoir reservoir = currentFrame[pixelIndex];
-                    spatialReuse(reservoir, point, x, y, currentFrame);
-                    spatialFrame[pixelIndex] = reservoir;
+        double best[2], measured[2];
+        vector<Color> images[2];
+        for (int mode = 0; mode < 2; mode++) {
+            RenderConfig config = baseConfig;
+            config.fusedPipeline = (mode == 1);
+            renderer.resetHistory();
+            best[mode] = 1e30;
+            unsigned long long misses = 0;
+            for (int run = 0; run <= repeats; run++) {
+                unsigned long long missesBefore = missCounter.read();
+                double t0 = wallTime();
+                renderer.render(config, images[mode]);
+                if (run > 0) {
+                    best[mode] = min(best[mode], wallTime() - t0);
+                    misses += missCounter.read() - missesBefore;
                 }
             }
-            currentFrame = spatialFrame;
+            measured[mode] = static_cast<double>(misses) * cacheLineBytes / repeats;
         }
-        
-        // Passo 3: Geração da imagem final
-        for (int y = 0; y < HEIGHT; y++) {
-            for (int x = 0; x < WIDTH; x++) {
-                int pixelIndex = y * WIDTH + x;
-                SurfacePoint point = surfacePoints[pixelIndex];
-                Reservoir& reservoir = currentFrame[pixelIndex];
-                previousFrame[pixelIndex] = reservoir;
-                Color finalColor = reservoir.getFinalColor(scene.lights, point);
-                Color ambient = point.albedo * 0.005f;
-                finalColor += ambient;
-                image[pixelIndex] = finalColor;
-            }
+        cout.rdbuf(console);
+        bool identical = true;
+        for (size_t i = 0; i < images[0].size() && identical; i++) {
+            identical = memcmp(&images[0][i], &images[1][i], sizeof(Color)) == 0;
         }
+        allIdentical = allIdentical && identical;
         
-        clock_t end = clock();
-        double duration = static_cast<double>(end - start) / CLOCKS_PER_SEC;
-        cout << "Renderização concluída em " << duration << " segundos" << endl;
-        return image;
-    }
-    
-    void saveImage(const vector<Color>& image, const string& filename) const {
-        ofstream file(filename.c_str());
-        if (!file.is_open()) {
-            cerr << "Erro ao criar arquivo " << filename << endl;
-            return;
-        }
-        file << "P3" << endl << WIDTH << " " << HEIGHT << endl << "255" << endl;
-        for (int y = 0; y < HEIGHT; y++) {
-            for (int x = 0; x < WIDTH; x++) {
-                Color pixel = image[y * WIDTH + x];
-                pixel.clamp();
-                int r = static_cast<int>(pixel.r * 255);
-                int g = static_cast<int>(pixel.g * 255);
-                int b = static_cast<int>(pixel.b * 255);
-                file << r << " " << g << " " << b << " ";
+        // Bytes por pixel: reservatório, G-buffer (+ cache de luzes) e imagem
+        double reservoir = static_cast<double>(USE_PACKED_RESERVOIRS ? sizeof(PackedReservoir) : sizeof(Reservoir));
+        double surface = static_cast<double>(sizeof(SurfacePoint));
+        if (renderer.lightCache.enabled) surface += renderer.scene.lights.size() * sizeof(LightCacheEntry);
+        double color = static_cast<double>(sizeof(Color));
+        ostringstream resolution;
+        resolution << WIDTH << "x" << HEIGHT;
+        for (int mode = 0; mode < 2; mode++) {
+            // Distância de reuso: bytes tocados entre produzir um reservatório e relê-lo
+            double reuse = pixels * (surface + 3.0 * reservoir);
+            if (mode == 1) {
+                double bands = passes > 0 ? passes * renderer.fusedBandLag() + 1 : 1;
+                reuse = min(pixels, bands * TILE_SIZE * WIDTH) * (surface + (passes + 1) * reservoir);
             }
-            file << endl;
+            // Primeira leitura (G-buffer, história) e escritas (quadros de reservatórios e imagem)
+            double bytes = pixels * (surface + reservoir + color);
+            bytes += pixels * reservoir * (mode == 0 || passes == 0 ? passes + 2 : passes + 1);
+            // Releituras entre etapas: G-buffer e reservatórios em cada passe espacial e no sombreamento
+            if (reuse > cacheBytes) bytes += pixels * (passes + 1) * (surface + reservoir);
+            
+            cout << setw(12) << resolution.str() << setw(10) << (mode ? "fundido" : "varredura")
+                 << setw(12) << setprecision(1) << best[mode] * 1e3 << setw(14) << reuse / (1024.0 * 1024.0);
+            if (missCounter.available()) cout << setw(16) << measured[mode] / (1024.0 * 1024.0);
+            else cout << setw(16) << "-";
+            cout << setw(16) << bytes / (1024.0 * 1024.0) << setw(12) << (mode ? (identical ? "sim" : "NAO") : "-") << endl;
+            json << "    {\"width\": " << WIDTH << ", \"height\": " << HEIGHT << ", \"mode\": \""
+                 << (mode ? "fused" : "sweeps") << "\", \"ms_per_frame\": " << best[mode] * 1e3
+                 << ", \"reuse_distance_mb\": " << reuse / (1024.0 * 1024.0);
+            if (missCounter.available()) json << ", \"dram_mb_per_frame\": " << measured[mode] / (1024.0 * 1024.0);
+            else json << ", \"dram_mb_per_frame\": null";
+            json << ", \"modelled_dram_mb_per_frame\": " << bytes / (1024.0 * 1024.0)
+                 << ", \"identical\": " << (identical ? "true" : "false") << "}"
+                 << (r + 1 < widths.size() || mode == 0 ? "," : "") << endl;
         }
-        file.close();
-        cout << "Imagem salva como " << filename << endl;
     }
-};
+    json << "  ]" << endl;
+    json << "}" << endl;
+    
+    WIDTH = savedWidth;
+    HEIGHT = savedHeight;
+    CHECKPOINT_FILE = savedCheckpoint;
+    cout << "(DRAM medida: falhas de LLC x " << setprecision(0) << cacheLineBytes << " bytes; DRAM modelo: estimativa"
+         << " que supõe a janela do fundido na cache, não é medição)" << endl;
+    if (!allIdentical) cerr << "Erro: o pipeline fundido divergiu das três varreduras" << endl;
+    return writeBenchmarkJSON(json.str()) && allIdentical;
+}
 
 void printUsage(const char* programName) {
     cout << "Uso: " << programName << " [opções]" << endl;
@@ -806,11 +5123,54 @@ void printUsage(const char* programName) {
     cout << "      --no-spatial-reuse         Desativa amostragem espacial" << endl;
     cout << "  -t, --temporal-reuse           Ativa amostragem temporal" << endl;
     cout << "      --no-temporal-reuse        Desativa amostragem temporal" << endl;
-    cout << "  -b, --baseline <arquivo.ppm>   Usa imagem baseline para reutilizacao temporal" << endl;
+    cout << "  -b, --baseline <arquivo>       Usa imagem baseline (P3/P6 8-16 bits/PFM) para reutilizacao temporal" << endl;
     cout << "      --biased                   Usa versão biased (padrao)" << endl;
     cout << "      --unbiased                 Usa versão unbiased CORRIGIDA" << endl;
     cout << "      --monte-carlo              Usa Monte Carlo puro (desabilita RIS)" << endl;
 	cout << "  -i, --iterations <numero>       Iterações recursivas a partir do baseline (padrão: 1)" << endl;    
+    cout << "      --frames <numero>          Sequência animada (câmera, luzes e esferas) com reprojeção temporal" << endl;
+    cout << "      --shadows                  Raios de sombra contra as esferas (um por pixel no ReSTIR)" << endl;
+    cout << "      --visibility-reuse         Com --shadows, zera reservatórios ocluídos antes da reutilização espacial" << endl;
+    cout << "      --scene <arquivo>          Carrega luzes, esferas e câmera de uma cena em texto ou binário (.rscn)" << endl;
+    cout << "      --write-scene <arquivo>    Grava a cena (padrão ou --scene) no formato binário .rscn e sai" << endl;
+    cout << "      --sweep <arquivo>          Renderiza cada linha do arquivo (opções -c, -s, -t, -v, -i...) no mesmo processo" << endl;
+    cout << "      --seed <numero>            Semente aleatória (padrao: time(NULL))" << endl;
+    cout << "  -j, --threads <numero>         Número de threads (padrao: 0 = todos os núcleos)" << endl;
+    cout << "      --benchmark-bvh            Mede a interseção BVH x força bruta (10^2 a 10^6 esferas)" << endl;
+    cout << "      --benchmark-kernels        Compara os kernels de interseção escalar/SSE/AVX2" << endl;
+    cout << "      --sphere-kernel <tipo>     Força o kernel: scalar, sse ou avx2 (padrao: CPUID)" << endl;
+    cout << "      --light-sampling <tipo>    Distribuição dos candidatos: uniform, alias ou tree (padrao: uniform)" << endl;
+    cout << "      --benchmark-light-sampling Compara amostragem uniforme x alias em igualdade de tempo" << endl;
+    cout << "      --benchmark-light-tree     Compara árvore de luzes x uniforme x alias (10^2 a 10^5 luzes)" << endl;
+    cout << "      --no-light-batch           Avalia candidatos um a um (sem lotes SoA/AVX2)" << endl;
+    cout << "      --packed-reservoirs        Quadros de reservatórios no formato compacto (8 bytes)" << endl;
+    cout << "      --benchmark-reservoir-layout  Banda e erro de imagem: reservatório float x compacto" << endl;
+    cout << "      --benchmark-unbiased-reuse Alocações no heap da reutilização unbiased por pixel; verifica oclusão" << endl;
+    cout << "      --benchmark-hot-kernels    ns/pixel dos kernels quentes e de quadros completos, em JSON" << endl;
+    cout << "      --benchmark-json <arquivo> Saída JSON dos benchmarks (padrao: restir_benchmark.json; - = tela)" << endl;
+    cout << "      --benchmark-fused-pipeline Tempo e tráfego de DRAM estimado: pipeline fundido x três varreduras" << endl;
+    cout << "      --benchmark-convergence    MSE, relMSE e viés de cada configuração contra uma referência RIS" << endl;
+    cout << "      --convergence-configs <l>  Configurações método:candidatos, método = mc|ris|biased|unbiased" << endl;
+    cout << "                                 (padrao: " << CONVERGENCE_CONFIGS << ")" << endl;
+    cout << "      --time-budget <s>          Tempo por configuração (padrao: 2)" << endl;
+    cout << "      --sample-budget <n>        Candidatos por pixel por configuração, no lugar do tempo" << endl;
+    cout << "      --reference-samples <n>    Candidatos RIS por quadro da referência (padrao: 32)" << endl;
+    cout << "      --reference-frames <n>     Quadros RIS somados na referência (padrao: 64)" << endl;
+    cout << "      --spatial-passes <n>       Passes de reutilização espacial (padrao: 1)" << endl;
+    cout << "      --spatial-neighbors <n>    Vizinhos por passe, até " << ReSTIRRenderer::MAX_REUSE_INPUTS - 1
+         << " (padrao: 4 biased, 3 unbiased)" << endl;
+    cout << "      --spatial-radius <pixels>  Raio dos vizinhos espaciais (padrao: 20)" << endl;
+    cout << "      --spatial-neighbor-mode <m> disc (disco em torno do pixel) ou tile (bloco + halo de "
+         << SPATIAL_TILE_HALO << ") (padrao: disc)" << endl;
+    cout << "      --fused-pipeline           Etapas em frente de onda por faixas de blocos (experimental)" << endl;
+    cout << "      --no-fused-pipeline        Etapas em três varreduras do quadro inteiro (padrao)" << endl;
+    cout << "      --width <pixels>           Largura da imagem (padrao: 800)" << endl;
+    cout << "      --height <pixels>          Altura da imagem (padrao: 600)" << endl;
+    cout << "      --out-of-core <linhas>     Renderiza em faixas de <linhas> gravadas direto no arquivo (4K-16K)" << endl;
+    cout << "      --light-cache-budget <MB>  Memória máxima do cache de luzes por pixel; 0 desativa (padrao: 256)" << endl;
+    cout << "      --metrics <arquivo>        Tempo por fase, contadores e histograma de M em JSON (build com RESTIR_METRICS)" << endl;
+    cout << "      --checkpoint <arquivo>     Retoma reservatórios do arquivo (se existir) e o regrava a cada quadro" << endl;
+    cout << "      --image-format <formato>   Saída: p6 (binário), pfm (float HDR) ou p3 (texto) (padrao: p6)" << endl;
     cout << "  -h, --help                     Mostra esta ajuda" << endl;
     cout << endl;
     cout << "Exemplos:" << endl;
@@ -856,6 +5216,37 @@ bool parseArguments(int argc, char* argv[], string& baselineFile) {
         else if (arg == "-s" || arg == "--spatial-reuse") {
             ENABLE_SPATIAL_REUSE = true;
         }
+        else if (arg == "--spatial-passes" || arg == "--spatial-neighbors" || arg == "--spatial-radius") {
+            if (i + 1 < argc) {
+                int value = atoi(argv[++i]);
+                if (value < 1 || (arg == "--spatial-neighbors" && value > ReSTIRRenderer::MAX_REUSE_INPUTS - 1)) {
+                    cerr << "Erro: valor inválido para " << arg << ": " << argv[i] << endl;
+                    return false;
+                }
+                if (arg == "--spatial-passes") SPATIAL_PASSES = value;
+                else if (arg == "--spatial-neighbors") SPATIAL_NEIGHBORS = value;
+                else SPATIAL_RADIUS = value;
+            } else {
+                cerr << "Erro: " << arg << " requer um valor" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--spatial-neighbor-mode") {
+            if (i + 1 < argc) {
+                string mode = argv[++i];
+                if (mode == "disc") {
+                    SPATIAL_NEIGHBOR_MODE = SPATIAL_NEIGHBORS_DISC;
+                } else if (mode == "tile") {
+                    SPATIAL_NEIGHBOR_MODE = SPATIAL_NEIGHBORS_TILE;
+                } else {
+                    cerr << "Erro: modo de vizinhos desconhecido: " << mode << " (use disc ou tile)" << endl;
+                    return false;
+                }
+            } else {
+                cerr << "Erro: " << arg << " requer um valor" << endl;
+                return false;
+            }
+        }
         else if (arg == "--no-spatial-reuse") {
             ENABLE_SPATIAL_REUSE = false;
         }
@@ -898,48 +5289,499 @@ bool parseArguments(int argc, char* argv[], string& baselineFile) {
 			        return false;
 			    }
 			}
+        else if (arg == "--frames") {
+            if (i + 1 < argc) {
+                SEQUENCE_FRAMES = atoi(argv[++i]);
+                if (SEQUENCE_FRAMES <= 0) {
+                    cerr << "Erro: --frames deve ser maior que 0" << endl;
+                    return false;
+                }
+            } else {
+                cerr << "Erro: " << arg << " requer um valor" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--shadows") {
+            SHADOW_RAYS = true;
+        }
+        else if (arg == "--visibility-reuse") {
+            SHADOW_RAYS = true;
+            VISIBILITY_REUSE = true;
+        }
+        else if (arg == "--scene" || arg == "--write-scene") {
+            if (i + 1 < argc) {
+                if (arg == "--scene") SCENE_FILE = argv[++i];
+                else WRITE_SCENE_FILE = argv[++i];
+            } else {
+                cerr << "Erro: " << arg << " requer um arquivo" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--sweep") {
+            if (i + 1 < argc) {
+                SWEEP_FILE = argv[++i];
+            } else {
+                cerr << "Erro: " << arg << " requer um arquivo" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--seed") {
+            if (i + 1 < argc) {
+                RANDOM_SEED = static_cast<unsigned int>(strtoul(argv[++i], NULL, 10));
+            } else {
+                cerr << "Erro: " << arg << " requer um valor" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--benchmark-bvh") {
+            RUN_BVH_BENCHMARK = true;
+        }
+        else if (arg == "--benchmark-kernels") {
+            RUN_KERNEL_BENCHMARK = true;
+        }
+        else if (arg == "--sphere-kernel") {
+            if (i + 1 < argc) {
+                string kernel = argv[++i];
+                if (kernel == "scalar") SPHERE_KERNEL = SPHERE_KERNEL_SCALAR;
+                else if (kernel == "sse") SPHERE_KERNEL = SPHERE_KERNEL_SSE;
+                else if (kernel == "avx2") SPHERE_KERNEL = SPHERE_KERNEL_AVX2;
+                else {
+                    cerr << "Erro: kernel desconhecido: " << kernel << endl;
+                    return false;
+                }
+            } else {
+                cerr << "Erro: " << arg << " requer um valor" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--light-sampling") {
+            if (i + 1 < argc) {
+                string sampling = argv[++i];
+                if (sampling == "uniform") LIGHT_SAMPLING = LIGHT_SAMPLING_UNIFORM;
+                else if (sampling == "alias") LIGHT_SAMPLING = LIGHT_SAMPLING_ALIAS;
+                else if (sampling == "tree") LIGHT_SAMPLING = LIGHT_SAMPLING_TREE;
+                else {
+                    cerr << "Erro: amostragem de luzes desconhecida: " << sampling << endl;
+                    return false;
+                }
+            } else {
+                cerr << "Erro: " << arg << " requer um valor" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--benchmark-light-sampling") {
+            RUN_LIGHT_SAMPLING_BENCHMARK = true;
+        }
+        else if (arg == "--packed-reservoirs") {
+            USE_PACKED_RESERVOIRS = true;
+        }
+        else if (arg == "--benchmark-reservoir-layout") {
+            RUN_RESERVOIR_LAYOUT_BENCHMARK = true;
+        }
+        else if (arg == "--width" || arg == "--height") {
+            if (i + 1 < argc) {
+                int value = atoi(argv[++i]);
+                if (value <= 0) {
+                    cerr << "Erro: " << arg << " deve ser maior que 0" << endl;
+                    return false;
+                }
+                (arg == "--width" ? WIDTH : HEIGHT) = value;
+            } else {
+                cerr << "Erro: " << arg << " requer um valor" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--light-cache-budget") {
+            if (i + 1 < argc) {
+                LIGHT_CACHE_BUDGET_MB = atoi(argv[++i]);
+                if (LIGHT_CACHE_BUDGET_MB < 0) {
+                    cerr << "Erro: --light-cache-budget não pode ser negativo" << endl;
+                    return false;
+                }
+            } else {
+                cerr << "Erro: " << arg << " requer um valor" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--metrics") {
+            if (i + 1 < argc) {
+                METRICS_FILE = argv[++i];
+#ifndef RESTIR_METRICS
+                cerr << "Erro: --metrics requer um build com RESTIR_METRICS (cmake -DRESTIR_METRICS=ON)" << endl;
+                return false;
+#endif
+            } else {
+                cerr << "Erro: " << arg << " requer um valor" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--checkpoint") {
+            if (i + 1 < argc) {
+                CHECKPOINT_FILE = argv[++i];
+            } else {
+                cerr << "Erro: " << arg << " requer um valor" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--image-format") {
+            if (i + 1 < argc) {
+                string format = argv[++i];
+                if (format == "p3") IMAGE_FORMAT = IMAGE_FORMAT_P3;
+                else if (format == "p6") IMAGE_FORMAT = IMAGE_FORMAT_P6;
+                else if (format == "pfm") IMAGE_FORMAT = IMAGE_FORMAT_PFM;
+                else {
+                    cerr << "Erro: formato de imagem desconhecido: " << format << " (use p6, pfm ou p3)" << endl;
+                    return false;
+                }
+            } else {
+                cerr << "Erro: " << arg << " requer um valor" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--out-of-core") {
+            if (i + 1 < argc) {
+                OUT_OF_CORE_ROWS = atoi(argv[++i]);
+                if (OUT_OF_CORE_ROWS <= 0) {
+                    cerr << "Erro: --out-of-core requer um número de linhas maior que 0" << endl;
+                    return false;
+                }
+            } else {
+                cerr << "Erro: " << arg << " requer um valor" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--benchmark-unbiased-reuse") {
+            RUN_UNBIASED_REUSE_BENCHMARK = true;
+        }
+        else if (arg == "--benchmark-hot-kernels") {
+            RUN_HOT_KERNEL_BENCHMARK = true;
+        }
+        else if (arg == "--benchmark-convergence") {
+            RUN_CONVERGENCE_BENCHMARK = true;
+        }
+        else if (arg == "--benchmark-fused-pipeline") {
+            RUN_FUSED_PIPELINE_BENCHMARK = true;
+        }
+        else if (arg == "--fused-pipeline") {
+            FUSED_PIPELINE = true;
+        }
+        else if (arg == "--no-fused-pipeline") {
+            FUSED_PIPELINE = false;
+        }
+        else if (arg == "--convergence-configs") {
+            if (i + 1 < argc) {
+                CONVERGENCE_CONFIGS = argv[++i];
+                vector<ConvergenceConfig> configs;
+                if (!parseConvergenceConfigs(CONVERGENCE_CONFIGS, configs)) return false;
+            } else {
+                cerr << "Erro: " << arg << " requer um valor" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--time-budget") {
+            if (i + 1 < argc) {
+                TIME_BUDGET = atof(argv[++i]);
+                if (TIME_BUDGET <= 0) {
+                    cerr << "Erro: " << arg << " deve ser positivo" << endl;
+                    return false;
+                }
+            } else {
+                cerr << "Erro: " << arg << " requer um valor" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--sample-budget" || arg == "--reference-samples" || arg == "--reference-frames") {
+            if (i + 1 < argc) {
+                // Inteiros: "0.5" ou "8x" são rejeitados, em vez de truncados para 0 ou 8
+                const char* text = argv[++i];
+                char* end = 0;
+                long value = strtol(text, &end, 10);
+                if (end == text || *end != '\0' || value < 1 || value > 1000000000L) {
+                    cerr << "Erro: " << arg << " requer um inteiro positivo: " << text << endl;
+                    return false;
+                }
+                if (arg == "--sample-budget") SAMPLE_BUDGET = static_cast<int>(value);
+                else if (arg == "--reference-samples") REFERENCE_SAMPLES = static_cast<int>(value);
+                else REFERENCE_FRAMES = static_cast<int>(value);
+            } else {
+                cerr << "Erro: " << arg << " requer um valor" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--benchmark-json") {
+            if (i + 1 < argc) {
+                BENCHMARK_JSON_FILE = argv[++i];
+            } else {
+                cerr << "Erro: " << arg << " requer um valor" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--no-light-batch") {
+            USE_LIGHT_BATCH = false;
+        }
+        else if (arg == "--benchmark-light-tree") {
+            RUN_LIGHT_TREE_BENCHMARK = true;
+        }
+        else if (arg == "-j" || arg == "--threads") {
+            if (i + 1 < argc) {
+                NUM_THREADS = atoi(argv[++i]);
+                if (NUM_THREADS < 0) {
+                    cerr << "Erro: NUM_THREADS não pode ser negativo" << endl;
+                    return false;
+                }
+            } else {
+                cerr << "Erro: " << arg << " requer um valor" << endl;
+                return false;
+            }
+        }
         else {
             cerr << "Erro: Argumento desconhecido: " << arg << endl;
             printUsage(argv[0]);
             return false;
         }
     }
+    // Índices de pixel são int
+    if (static_cast<double>(WIDTH) * HEIGHT > 2147483647.0) {
+        cerr << "Erro: resolução " << WIDTH << "x" << HEIGHT << " excede o limite de pixels" << endl;
+        return false;
+    }
     return true;
 }
 
-string generateFilename() {
+// Grava o JSON de --metrics (só existe nos builds com RESTIR_METRICS)
+bool writeMetricsFile(double runStart) {
+#ifdef RESTIR_METRICS
+    if (!METRICS_FILE.empty()) return metrics.writeJSON(METRICS_FILE, wallTime() - runStart);
+#else
+    (void)runStart;
+#endif
+    return true;
+}
+
+string generateFilename(const RenderConfig& config) {
     ostringstream oss;
     
-    if (USE_MONTE_CARLO_ONLY) {
-        oss << "monte_carlo_pure_" << MAX_CANDIDATES << "_candidates.ppm";
+    if (config.monteCarlo) {
+        oss << "monte_carlo_pure_" << config.maxCandidates << "_candidates" << (config.shadowRays ? "_shadows" : "")
+            << imageExtension(static_cast<ImageFormat>(IMAGE_FORMAT));
     } else {
-        oss << "restir_" << (USE_UNBIASED_MODE ? "unbiased_CORRIGIDO" : "biased") << "_" << MAX_CANDIDATES << "_";
-        if (ENABLE_SPATIAL_REUSE) oss << "spatial_";
-        if (ENABLE_TEMPORAL_REUSE) oss << "temporal_";
-        if (BASELINE_RIS_SAMPLES > 0) {
-            oss << "baseline_ris_" << BASELINE_RIS_SAMPLES << "_";
-        } else if (USE_BASELINE_IMAGE) {
+        oss << "restir_" << (config.unbiased ? "unbiased_CORRIGIDO" : "biased") << "_" << config.maxCandidates << "_";
+        if (config.spatialReuse) oss << "spatial_";
+        if (config.temporalReuse) oss << "temporal_";
+        if (config.visibilityReuse) oss << "visibility_";
+        else if (config.shadowRays) oss << "shadows_";
+        if (config.baselineRisSamples > 0) {
+            oss << "baseline_ris_" << config.baselineRisSamples << "_";
+        } else if (config.useBaselineImage) {
             oss << "baseline_";
         }
-        oss << ".ppm";
+        oss << imageExtension(static_cast<ImageFormat>(IMAGE_FORMAT));
     }
     
     return oss.str();
 }
 
-int main(int argc, char* argv[]) {
+string generateFilename() {
+    return generateFilename(RenderConfig());
+}
+
+// Tarefa do --sweep: uma configuração e quantas iterações renderizar com ela
+struct SweepJob {
+    string options;
+    RenderConfig config;
+    int iterations;
+};
+
+// Lê o arquivo de tarefas do --sweep. Cada linha (vazias e as iniciadas por
+// '#' são ignoradas) traz as opções de uma renderização, aplicadas sobre as da
+// linha de comando: -c, --biased, --unbiased, -s, -t, --no-spatial-reuse,
+// --no-temporal-reuse, -v, -i, --monte-carlo, --shadows, --visibility-reuse
+// e --spatial-*.
+bool parseSweepFile(const string& filename, vector<SweepJob>& jobs) {
+    ifstream file(filename.c_str());
+    if (!file) {
+        cerr << "Erro: não foi possível abrir o arquivo de tarefas " << filename << endl;
+        return false;
+    }
+    string line;
+    int lineNumber = 0;
+    while (getline(file, line)) {
+        lineNumber++;
+        size_t comment = line.find('#');
+        if (comment != string::npos) line = line.substr(0, comment);
+        istringstream tokens(line);
+        vector<string> args;
+        string token;
+        while (tokens >> token) args.push_back(token);
+        if (args.empty()) continue;
+        
+        SweepJob job;
+        job.iterations = RECURSIVE_ITERATIONS;
+        for (size_t i = 0; i < args.size(); i++) job.options += (i > 0 ? " " : "") + args[i];
+        for (size_t i = 0; i < args.size(); i++) {
+            const string& arg = args[i];
+            if (arg == "--biased") job.config.unbiased = false;
+            else if (arg == "--unbiased") job.config.unbiased = true;
+            else if (arg == "-s" || arg == "--spatial-reuse") job.config.spatialReuse = true;
+            else if (arg == "--no-spatial-reuse") job.config.spatialReuse = false;
+            else if (arg == "-t" || arg == "--temporal-reuse") job.config.temporalReuse = true;
+            else if (arg == "--shadows") job.config.shadowRays = true;
+            else if (arg == "--visibility-reuse") job.config.shadowRays = job.config.visibilityReuse = true;
+            else if (arg == "--no-temporal-reuse") job.config.temporalReuse = false;
+            else if (arg == "--fused-pipeline") job.config.fusedPipeline = true;
+            else if (arg == "--no-fused-pipeline") job.config.fusedPipeline = false;
+            else if (arg == "--monte-carlo") {
+                job.config.monteCarlo = true;
+                job.config.spatialReuse = false;
+                job.config.temporalReuse = false;
+                job.config.useBaselineImage = false;
+            }
+            else if (arg == "--spatial-neighbor-mode" && i + 1 < args.size()) {
+                string mode = args[++i];
+                if (mode == "disc") job.config.spatialNeighborMode = SPATIAL_NEIGHBORS_DISC;
+                else if (mode == "tile") job.config.spatialNeighborMode = SPATIAL_NEIGHBORS_TILE;
+                else {
+                    cerr << "Erro: " << filename << ":" << lineNumber << ": modo de vizinhos desconhecido: " << mode << endl;
+                    return false;
+                }
+            }
+            else if ((arg == "-c" || arg == "--candidates" || arg == "-v" || arg == "--baseline-ris" ||
+                      arg == "-i" || arg == "--iterations" || arg == "--spatial-passes" ||
+                      arg == "--spatial-neighbors" || arg == "--spatial-radius") && i + 1 < args.size()) {
+                int value = atoi(args[++i].c_str());
+                if (value < 1 || (arg == "--spatial-neighbors" && value > ReSTIRRenderer::MAX_REUSE_INPUTS - 1)) {
+                    cerr << "Erro: " << filename << ":" << lineNumber << ": valor inválido para " << arg << ": " << args[i] << endl;
+                    return false;
+                }
+                if (arg == "-c" || arg == "--candidates") job.config.maxCandidates = value;
+                else if (arg == "-v" || arg == "--baseline-ris") job.config.baselineRisSamples = value;
+                else if (arg == "-i" || arg == "--iterations") job.iterations = value;
+                else if (arg == "--spatial-passes") job.config.spatialPasses = value;
+                else if (arg == "--spatial-neighbors") job.config.spatialNeighbors = value;
+                else job.config.spatialRadius = value;
+            }
+            else {
+                cerr << "Erro: " << filename << ":" << lineNumber << ": opção inválida ou sem valor: " << arg << endl;
+                return false;
+            }
+        }
+        jobs.push_back(job);
+    }
+    if (jobs.empty()) {
+        cerr << "Erro: nenhuma tarefa em " << filename << endl;
+        return false;
+    }
+    return true;
+}
+
+// Varredura de parâmetros num só processo: renderizador, esferas, G-buffer,
+// cache de luzes e baselines são construídos uma vez e compartilhados; cada
+// tarefa começa sem história temporal (como um processo novo) e paga só o
+// próprio RIS/reutilização. As imagens de cada tarefa são iguais às de uma
+// execução separada com as mesmas opções.
+bool runSweep(ReSTIRRenderer& renderer, const vector<SweepJob>& jobs) {
+    string extension = imageExtension(static_cast<ImageFormat>(IMAGE_FORMAT));
+    double setupStart = wallTime();
+    renderer.ensureGBuffer();
+    double setupSeconds = wallTime() - setupStart;
+    
+    vector<double> seconds(jobs.size());
+    for (size_t j = 0; j < jobs.size(); j++) {
+        const SweepJob& job = jobs[j];
+        cout << endl << "=== Tarefa " << (j + 1) << "/" << jobs.size() << ": " << job.options << " ===" << endl;
+        renderer.resetHistory();
+        char jobPrefix[24];
+        sprintf(jobPrefix, "sweep%02d_", static_cast<int>(j + 1));
+        string filename = jobPrefix + generateFilename(job.config);
+        filename = filename.substr(0, filename.size() - extension.size());
+        
+        double start = wallTime();
+        vector<Color> image;
+        for (int iter = 1; iter <= job.iterations; iter++) {
+            // Como no modo -i, o baseline (arquivo ou RIS interno) só entra na primeira iteração
+            RenderConfig config = job.config;
+            if (iter > 1) {
+                config.useBaselineImage = false;
+                config.baselineRisSamples = 0;
+            }
+            renderer.render(config, image);
+            char iterSuffix[16];
+            sprintf(iterSuffix, "_iter%d", iter);
+            string iterFilename = filename + iterSuffix + extension;
+            renderer.saveImage(image, iterFilename);
+            cout << "Salvo: " << iterFilename << endl;
+        }
+        seconds[j] = wallTime() - start;
+    }
+    
+    cout << endl << "=== Varredura (" << jobs.size() << " tarefas, " << WIDTH << "x" << HEIGHT << ") ===" << endl;
+    cout << "G-buffer + cache de luzes (compartilhados): " << fixed << setprecision(3) << setupSeconds << " s" << endl;
+    cout << setw(6) << "tarefa" << setw(8) << "iter" << setw(12) << "s" << "  opções" << endl;
+    double total = 0;
+    for (size_t j = 0; j < jobs.size(); j++) {
+        cout << setw(6) << (j + 1) << setw(8) << jobs[j].iterations << setw(12) << seconds[j] << "  " << jobs[j].options << endl;
+        total += seconds[j];
+    }
+    cout << "Total das tarefas: " << total << " s" << endl;
+    cout.unsetf(ios::fixed);
+    return true;
+}
+
+// Ponto de entrada do renderizador. Compilado com RESTIR_NO_MAIN (biblioteca
+// restir_core do CMake), o main() fica a cargo dos executáveis restir e restir_bench.
+int restirMain(int argc, char* argv[]) {
+#ifdef _WIN32
     // Configura a página de código do console para UTF-8
     SetConsoleOutputCP(CP_UTF8);
     // Opcional: Se você estiver lendo entrada do usuário com acentos
     SetConsoleCP(CP_UTF8);
+#endif
     cout << "=== Renderizador ReSTIR CORRIGIDO com Baseline RIS Interno - Compatível C++98 ===" << endl;
     string baselineFile;
+    RANDOM_SEED = static_cast<unsigned int>(time(NULL));
     if (!parseArguments(argc, argv, baselineFile)) {
         return 1;
     }
     
+    if (RUN_BVH_BENCHMARK) {
+        runBVHBenchmark();
+        return 0;
+    }
+    if (RUN_KERNEL_BENCHMARK) {
+        runKernelBenchmark();
+        return 0;
+    }
+    if (RUN_LIGHT_SAMPLING_BENCHMARK) {
+        runLightSamplingBenchmark();
+        return 0;
+    }
+    if (RUN_LIGHT_TREE_BENCHMARK) {
+        runLightTreeBenchmark();
+        return 0;
+    }
+    if (RUN_RESERVOIR_LAYOUT_BENCHMARK) {
+        runReservoirLayoutBenchmark();
+        return 0;
+    }
+    if (RUN_UNBIASED_REUSE_BENCHMARK) {
+        return runUnbiasedReuseBenchmark() ? 0 : 1;
+    }
+    if (RUN_HOT_KERNEL_BENCHMARK) {
+        return runHotKernelBenchmark() ? 0 : 1;
+    }
+    if (RUN_CONVERGENCE_BENCHMARK) {
+        return runConvergenceBenchmark() ? 0 : 1;
+    }
+    if (RUN_FUSED_PIPELINE_BENCHMARK) {
+        return runFusedPipelineBenchmark() ? 0 : 1;
+    }
+    
     cout << "Configuracao:" << endl;
+    cout << "  RESOLUCAO: " << WIDTH << "x" << HEIGHT;
+    if (OUT_OF_CORE_ROWS > 0) cout << " (fora do núcleo, faixas de " << OUT_OF_CORE_ROWS << " linhas)";
+    cout << endl;
     cout << "  MAX_CANDIDATES: " << MAX_CANDIDATES << endl;
+    cout << "  SEMENTE: " << RANDOM_SEED << endl;
     
     if (USE_MONTE_CARLO_ONLY) {
         cout << "  MODO: MONTE CARLO PURO" << endl;
@@ -947,7 +5789,15 @@ int main(int argc, char* argv[]) {
         cout << "  AMOSTRAGEM_TEMPORAL: DESABILITADA (Monte Carlo puro)" << endl;
         cout << "  BASELINE_IMAGE: DESABILITADA (Monte Carlo puro)" << endl;
     } else {
-        cout << "  AMOSTRAGEM_ESPACIAL: " << (ENABLE_SPATIAL_REUSE ? "ATIVADA" : "DESATIVADA") << endl;
+        cout << "  AMOSTRAGEM_ESPACIAL: " << (ENABLE_SPATIAL_REUSE ? "ATIVADA" : "DESATIVADA");
+        if (ENABLE_SPATIAL_REUSE) {
+            cout << " (" << SPATIAL_PASSES << " passe(s), ";
+            if (SPATIAL_NEIGHBORS > 0) cout << SPATIAL_NEIGHBORS;
+            else cout << (USE_UNBIASED_MODE ? 3 : 4);
+            cout << " vizinhos, raio " << SPATIAL_RADIUS << ", "
+                 << (SPATIAL_NEIGHBOR_MODE == SPATIAL_NEIGHBORS_TILE ? "bloco + halo" : "disco") << ")";
+        }
+        cout << endl;
         cout << "  AMOSTRAGEM_TEMPORAL: " << (ENABLE_TEMPORAL_REUSE ? "ATIVADA" : "DESATIVADA") << endl;
         
         if (BASELINE_RIS_SAMPLES > 0) {
@@ -959,11 +5809,68 @@ int main(int argc, char* argv[]) {
         cout << "  MODO: " << (USE_UNBIASED_MODE ? "UNBIASED CORRIGIDO - SEM ESCURECIMENTO" : "BIASED") << endl;
     }
     
-    cout << "  GEOMETRIA: Plano xadrez + Esferas otimizadas (albedo 0.95)" << endl;
-    cout << "  ILUMINACAO: 7 luzes focadas para destacar diferenças" << endl;
+    cout << "  AMOSTRAGEM_LUZES: " << (LIGHT_SAMPLING == LIGHT_SAMPLING_ALIAS ? "ALIAS (intensidade x luminância)" :
+                                   LIGHT_SAMPLING == LIGHT_SAMPLING_TREE ? "ARVORE DE LUZES" : "UNIFORME") << endl;
+    cout << "  FORMATO_IMAGEM: " << (IMAGE_FORMAT == IMAGE_FORMAT_PFM ? "PFM (float)" :
+                                 IMAGE_FORMAT == IMAGE_FORMAT_P3 ? "P3 (texto)" : "P6 (binário)") << endl;
+    cout << "  SOMBRAS: " << (VISIBILITY_REUSE ? "ATIVADAS + REUTILIZACAO DE VISIBILIDADE" :
+                          SHADOW_RAYS ? "ATIVADAS" : "DESATIVADAS") << endl;
+    if (!SWEEP_FILE.empty()) cout << "  VARREDURA: " << SWEEP_FILE << endl;
+    if (SEQUENCE_FRAMES > 0) cout << "  SEQUENCIA: " << SEQUENCE_FRAMES << " quadros animados (reprojeção temporal)" << endl;
+    if (!CHECKPOINT_FILE.empty()) cout << "  CHECKPOINT: " << CHECKPOINT_FILE << endl;
+    if (!METRICS_FILE.empty()) cout << "  METRICAS: " << METRICS_FILE << endl;
+    cout << "  CACHE_LUZES: " << (LIGHT_CACHE_BUDGET_MB > 0 ? "AUTOMATICO (orçamento " : "DESATIVADO");
+    if (LIGHT_CACHE_BUDGET_MB > 0) cout << LIGHT_CACHE_BUDGET_MB << " MB)";
+    cout << endl;
+    cout << "  PIPELINE: " << (FUSED_PIPELINE ? "FUNDIDO (frente de onda por faixas de blocos)" : "TRES VARREDURAS") << endl;
+    cout << "  RESERVATORIOS: " << (USE_PACKED_RESERVOIRS ? "COMPACTO (8 bytes)" : "FLOAT (20 bytes)") << endl;
+    cout << "  KERNEL_ESFERAS: " << sphereKernelName(SPHERE_KERNEL >= 0 ? static_cast<SphereKernelType>(SPHERE_KERNEL) : detectSphereKernel()) << endl;
+#ifdef _OPENMP
+    cout << "  THREADS: " << (NUM_THREADS > 0 ? NUM_THREADS : omp_get_max_threads()) << endl;
+#else
+    cout << "  THREADS: 1 (compilado sem OpenMP)" << endl;
+#endif
+    if (SCENE_FILE.empty()) {
+        cout << "  GEOMETRIA: Plano xadrez + Esferas otimizadas (albedo 0.95)" << endl;
+        cout << "  ILUMINACAO: 7 luzes focadas para destacar diferenças" << endl;
+    } else {
+        cout << "  CENA: " << SCENE_FILE << " (+ plano xadrez)" << endl;
+    }
     cout << endl;
     
-    ReSTIRRenderer renderer;
+    double runStart = wallTime();
+    ReSTIRRenderer renderer(SCENE_FILE.empty());
+    if (!SCENE_FILE.empty() && !SceneFile::load(SCENE_FILE, renderer.scene)) return 1;
+    if (!WRITE_SCENE_FILE.empty()) {
+        return (SceneFile::saveBinary(WRITE_SCENE_FILE, renderer.scene) && writeMetricsFile(runStart)) ? 0 : 1;
+    }
+    
+    if (!SWEEP_FILE.empty()) {
+        vector<SweepJob> jobs;
+        if (!parseSweepFile(SWEEP_FILE, jobs)) return 1;
+        if (OUT_OF_CORE_ROWS > 0 || SEQUENCE_FRAMES > 0 || !CHECKPOINT_FILE.empty()) {
+            cout << "Aviso: --sweep ignora --out-of-core, --frames e --checkpoint" << endl;
+            CHECKPOINT_FILE.clear();
+        }
+        if (USE_BASELINE_IMAGE && !baselineFile.empty() && !renderer.loadBaselineImage(baselineFile)) {
+            cout << "Continuando sem imagem baseline..." << endl;
+        }
+        bool swept = runSweep(renderer, jobs);
+        bool written = renderer.imageWriter.wait();
+        return (writeMetricsFile(runStart) && swept && written) ? 0 : 1;
+    }
+    
+    if (OUT_OF_CORE_ROWS > 0) {
+        if (USE_MONTE_CARLO_ONLY || BASELINE_RIS_SAMPLES > 0 || RECURSIVE_ITERATIONS > 1 || SEQUENCE_FRAMES > 0) {
+            cout << "Aviso: o modo fora do núcleo renderiza um único quadro ReSTIR "
+                 << "(sem Monte Carlo, baseline RIS, iterações ou sequência)" << endl;
+        }
+        USE_MONTE_CARLO_ONLY = false;
+        string filename = generateFilename();
+        filename = filename.substr(0, filename.size() - 4) + "_iter1" + filename.substr(filename.size() - 4);
+        bool rendered = renderer.renderOutOfCore(filename, OUT_OF_CORE_ROWS);
+        return (writeMetricsFile(runStart) && rendered) ? 0 : 1;
+    }
     
     // Verificar se deve carregar baseline de arquivo (só se não for RIS interno)
     if (USE_BASELINE_IMAGE && !baselineFile.empty() && !USE_MONTE_CARLO_ONLY && BASELINE_RIS_SAMPLES == 0) {
@@ -972,35 +5879,73 @@ int main(int argc, char* argv[]) {
         }
     }
     
+    // Retoma os reservatórios de uma execução anterior; uma baseline, se houver,
+    // tem precedência no primeiro quadro
+    if (!CHECKPOINT_FILE.empty() && !USE_MONTE_CARLO_ONLY) {
+        renderer.loadCheckpoint(CHECKPOINT_FILE);
+    }
+    
 	vector<Color> image;
 	string baseFilename = generateFilename();
-	// Remover sufixo ".ppm" para montar nomes numerados
+	// Remover a extensão (".ppm"/".pfm") para montar nomes numerados
+	string extension = imageExtension(static_cast<ImageFormat>(IMAGE_FORMAT));
 	string fn_prefix = baseFilename;
-	if (fn_prefix.size() >= 4 && fn_prefix.substr(fn_prefix.size()-4) == ".ppm")
+	if (fn_prefix.size() >= 4 && fn_prefix.substr(fn_prefix.size()-4) == extension)
 	    fn_prefix = fn_prefix.substr(0, fn_prefix.size()-4);
 	
-	// Primeira renderização normalmente
-	image = renderer.render();
-	string iterFilename = fn_prefix + "_iter1.ppm";
-	renderer.saveImage(image, iterFilename);
-	cout << "Salvo: " << iterFilename << endl;
+	string iterFilename;
+	// Configuração por renderização: o baseline (arquivo ou RIS interno) só entra na
+	// primeira, e é desligado nesta cópia, não nas variáveis globais
+	RenderConfig config;
+	if (SEQUENCE_FRAMES > 0) {
+	    // Sequência animada: câmera, luzes e esferas se movem a cada quadro e a
+	    // reutilização temporal lê a história reprojetada pelos vetores de movimento
+	    if (RECURSIVE_ITERATIONS > 1) {
+	        cout << "Aviso: --frames tem precedência sobre -i; " << RECURSIVE_ITERATIONS << " iterações ignoradas" << endl;
+	    }
+	    SceneAnimation animation;
+	    animation.capture(renderer.scene);
+	    renderer.trackMotion = true;
+	    for (int frame = 0; frame < SEQUENCE_FRAMES; ++frame) {
+	        animation.apply(renderer.scene, static_cast<float>(frame) / static_cast<float>(SEQUENCE_FRAMES));
+	        renderer.render(config, image);
+	        char frameSuffix[24];
+	        sprintf(frameSuffix, "_frame%04d", frame);
+	        string frameFilename = fn_prefix + string(frameSuffix) + extension;
+	        renderer.saveImage(image, frameFilename);
+	        cout << "Salvo: " << frameFilename << endl;
+	        if (frame == 0) iterFilename = frameFilename;
+	        config.useBaselineImage = false;
+	        config.baselineRisSamples = 0; // Não gera novo baseline RIS
+	    }
+	} else {
+		// Primeira renderização normalmente
+		renderer.render(config, image);
+		iterFilename = fn_prefix + "_iter1" + extension;
+		renderer.saveImage(image, iterFilename);
+		cout << "Salvo: " << iterFilename << endl;
+		config.useBaselineImage = false;
+		config.baselineRisSamples = 0; // Não gera novo baseline RIS
 	
-	// Iterações recursivas a partir do baseline gerado
-	for(int iter = 2; iter <= RECURSIVE_ITERATIONS; ++iter) {
-	    // Salva resultado anterior como baseline temporária
-	    renderer.baselineImage = image;
-	    renderer.hasBaselineImage = true;
-	    USE_BASELINE_IMAGE = true;
-	    BASELINE_RIS_SAMPLES = 0; // Não gera novo baseline RIS
-	    vector<Color> newImage = renderer.render();
-	    char iterSuffix[16];
-	    sprintf(iterSuffix, "_iter%d.ppm", iter); 
-	    string nextFilename = fn_prefix + string(iterSuffix);
-	    renderer.saveImage(newImage, nextFilename);
-	    cout << "Salvo: " << nextFilename << endl;
-	    image = newImage;
+		// Iterações recursivas: a reutilização temporal continua exata a partir dos
+		// reservatórios do quadro anterior (previousFrame), sem passar pela imagem.
+		// Em pipeline: a iteração k é codificada e gravada pela thread de E/S enquanto
+		// a k+1 renderiza no buffer que saveImage() devolveu (o da iteração k-1), e os
+		// reservatórios vêm dos buffers persistentes do renderizador; nada é copiado.
+		for(int iter = 2; iter <= RECURSIVE_ITERATIONS; ++iter) {
+		    renderer.render(config, image);
+		    char iterSuffix[16];
+		    sprintf(iterSuffix, "_iter%d", iter);
+		    string nextFilename = fn_prefix + string(iterSuffix) + extension;
+		    renderer.saveImage(image, nextFilename);
+		    cout << "Salvo: " << nextFilename << endl;
+		}
 	}
     
+    METRIC_CLOCK(waitStart);
+    bool written = renderer.imageWriter.wait();
+    METRIC_END_PHASE(PHASE_IO, waitStart);
+    if (!writeMetricsFile(runStart) || !written) return 1;
     cout << "Programa finalizado com sucesso!" << endl;
     cout << "Abra o arquivo '" << iterFilename << "' para ver o resultado!" << endl;
     
@@ -1014,3 +5959,9 @@ int main(int argc, char* argv[]) {
     
     return 0;
 }
+
+#ifndef RESTIR_NO_MAIN
+int main(int argc, char* argv[]) {
+    return restirMain(argc, argv);
+}
+#endif
@@ -0,0 +1,16 @@
+// Executável "restir_bench" do CMake: roda o renderizador no modo
+// --benchmark-hot-kernels. Aceita as demais opções (--width, --height, -c,
+// --unbiased, --threads, --seed...) e --benchmark-json <arquivo> para a saída.
+// Linkado com restir_core_bench, que conta as alocações no heap: outro modo,
+// como --benchmark-unbiased-reuse, pode ser pedido na linha de comando.
+#include <vector>
+
+int restirMain(int argc, char* argv[]);
+
+int main(int argc, char* argv[]) {
+    static char mode[] = "--benchmark-hot-kernels";
+    std::vector<char*> args(argv, argv + argc);
+    args.insert(args.begin() + 1, mode);
+    args.push_back(0);
+    return restirMain(static_cast<int>(args.size()) - 1, &args[0]);
+}
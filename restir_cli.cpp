@@ -0,0 +1,7 @@
+// Executável "restir" do CMake: a lógica está na biblioteca restir_core
+// (Restir_Completo.cpp compilado com RESTIR_NO_MAIN)
+int restirMain(int argc, char* argv[]);
+
+int main(int argc, char* argv[]) {
+    return restirMain(argc, argv);
+}